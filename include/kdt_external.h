@@ -0,0 +1,50 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#ifndef _KDTREE_EXTERNAL_
+#define _KDTREE_EXTERNAL_
+
+#include <kdt_vertices.h>
+
+// Opções da ordenação em memória externa.
+typedef struct {
+	size_t memory_budget;		// Memória, em bytes, para os pontos em memória e os buffers de escrita.
+	kd_options_t kd_options;	// Opções da ordenação de cada célula em memória (só a ordem BFS se aplica).
+} kd_external_options_t;
+
+void KDT_external_options_init(kd_external_options_t* options);
+
+/* external-memory kd sort of a .kdp point file (see kdt_io.h) into a .kdp file of
+ * 24-byte records. The top levels of the kd tree are cut at exact medians: each level
+ * takes a few selection passes over the file, counting the points between splitters
+ * drawn from a sample and refining inside the interval that holds the median, with
+ * the coordinate order broken by the point index. Cells that fit
+ * options->memory_budget are sorted in memory, and the per-cell outputs are merged
+ * level by level from the temporary files, so the output is the global BFS order of
+ * KDT_vertices_BRIO with the default options (identical to it when the coordinates
+ * are distinct). brio_ratio, bfs_levels, bucket, curve and split of
+ * options->kd_options are ignored. The temporary files never hold more than 2n points.
+ * If index_output is not NULL, it receives the original index (uint64_t) of each
+ * output point */
+status_t KDT_external_sort(const char* input, const char* output, const char* index_output,
+                           const kd_external_options_t* options);
+
+#endif
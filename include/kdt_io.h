@@ -0,0 +1,82 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#ifndef _KDTREE_IO_
+#define _KDTREE_IO_
+
+#include <hxt_vertices.h>
+
+// Formato binário de pontos (.kdp), versão KDT_IO_VERSION. Tudo na ordem de bytes
+// nativa, que o cabeçalho permite conferir:
+//
+//   char     magic[8]       "KDTPNTS"
+//   uint32_t version
+//   uint32_t endian         0x01020304
+//   uint32_t header_size    início dos pontos (KDT_IO_HEADER_SIZE)
+//   uint32_t stride         bytes por ponto: 24 (x y z) ou sizeof(vertex_t)
+//   uint64_t count
+//   double   min[3], max[3] bbox dos pontos
+//
+// Cada ponto são três doubles; com stride == sizeof(vertex_t), seguidos do índice
+// original (uint64_t), e o arquivo mapeado já é um array de vertex_t.
+#define KDT_IO_VERSION 1
+#define KDT_IO_HEADER_SIZE 128
+
+// Conjunto de pontos mapeado na memória.
+typedef struct {
+	bbox_t bbox;
+	uint64_t count;
+	uint32_t stride;		// Bytes entre pontos consecutivos.
+	uint32_t header_size;	// Bytes do cabeçalho, antes do primeiro ponto.
+	const double* coord;	// Coordenadas do primeiro ponto.
+	vertex_t* vertices;		// Os pontos como vertex_t (só com stride == sizeof(vertex_t)), senão NULL.
+	void* map;
+	size_t map_size;
+} kd_point_file_t;
+
+/* writes n points (coord[0..2] every stride bytes) to a .kdp file whose records are
+ * file_stride bytes long (24, or sizeof(vertex_t) to also store the point index) */
+status_t KDT_io_write(const char* filename, const double* coord, size_t stride, uint64_t n, uint32_t file_stride);
+
+/* maps a .kdp file without copying it. The mapping is private: the points can be
+ * sorted in place (e.g. by KDT_vertices_BRIO on points->vertices) and the file is
+ * left untouched */
+status_t KDT_io_map(const char* filename, kd_point_file_t* points);
+status_t KDT_io_unmap(kd_point_file_t* points);
+
+/* opens a .kdp file for reading without mapping it, for inputs larger than memory:
+ * points receives the count, stride, bbox and header_size (coord, vertices and map
+ * are NULL) and the points are read from *file, header_size bytes in */
+status_t KDT_io_open(const char* filename, FILE** file, kd_point_file_t* points);
+
+/* writes the header of a .kdp file of count points with records of stride bytes at
+ * the current position of file, for writers that stream the points themselves */
+status_t KDT_io_write_header(FILE* file, uint32_t stride, uint64_t count, const bbox_t* bbox);
+
+/* reads a TetGen .node file into a new vertex array (dist holds the point index).
+ * The file is mapped and parsed in line-aligned chunks by num_threads threads
+ * (0: OpenMP default); bbox receives the bounding box of the points */
+status_t KDT_io_read_node(const char* filename, vertex_t** vertices, uint32_t* n, bbox_t* bbox, int num_threads);
+
+/* converts a TetGen .node file into a .kdp file */
+status_t KDT_io_convert_node(const char* node_file, const char* filename, uint32_t file_stride);
+
+#endif
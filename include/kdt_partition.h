@@ -0,0 +1,70 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#ifndef _KDTREE_PARTITION_
+#define _KDTREE_PARTITION_
+
+#include <hxt_vertices.h>
+
+// Número máximo de blocos de uma partição paralela
+#define KDT_MAX_PARTITION_TASKS 256
+
+// Pontos por bloco de uma passada paralela. O número de blocos só depende de n, nunca
+// do número de threads, para que a mesma semente reproduza a mesma árvore com
+// qualquer número de threads (o arranjo dos empates depende dos blocos).
+#define KDT_PARTITION_TASK_SIZE 65536
+
+static inline int KDT_partition_tasks( uint64_t n )
+{
+	const uint64_t tasks = (n + KDT_PARTITION_TASK_SIZE - 1)/KDT_PARTITION_TASK_SIZE;
+	if ( tasks < 1 )
+		return 1;
+	return tasks > KDT_MAX_PARTITION_TASKS ? KDT_MAX_PARTITION_TASKS : (int) tasks;
+}
+
+// Função para trocar dois vértices (o registro inteiro, para que dist acompanhe as
+// coordenadas)
+static inline void __swapVertices( vertex_t *a, vertex_t *b )
+{
+	vertex_t tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/* partitions v[0..n) into [coord[axis] <= pivot | coord[axis] > pivot]
+ * and returns the size of the first part. The keys are gathered from the vertex_t
+ * records with AVX-512 when the CPU has it (chosen at run time) */
+uint64_t KDT_partition_le(vertex_t* v, uint64_t n, int axis, double pivot);
+
+/* same as KDT_partition_le, split into KDT_partition_tasks(n) blocks run as OpenMP
+ * tasks: the result does not depend on the number of threads running them */
+uint64_t KDT_parallel_partition_le(vertex_t* v, uint64_t n, int axis, double pivot);
+
+/* partitions the packed keys key[0..n), moving index[0..n) along with them, into
+ * [key <= pivot | key > pivot] and returns the size of the first part. The keys are
+ * read with plain vector loads (AVX-512 or AVX2, chosen at run time) */
+uint64_t KDT_keys_partition_le(double* key, uint32_t* index, uint64_t n, double pivot);
+
+/* same as KDT_keys_partition_le, split into KDT_partition_tasks(n) blocks run as
+ * OpenMP tasks */
+uint64_t KDT_keys_parallel_partition_le(double* key, uint32_t* index, uint64_t n, double pivot);
+
+#endif
@@ -50,4 +50,6 @@ void points_within_spiral(vertex_t* vertices, uint32_t npts);
 
 void points_around_saddle(vertex_t* vertices, uint32_t npts);
 
+void points_on_grid(vertex_t* vertices, uint32_t npts, uint32_t resolution);
+
 #endif // _KDTREE_POINT_GENERATORS_
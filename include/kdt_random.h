@@ -0,0 +1,158 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#ifndef _KDTREE_RANDOM_
+#define _KDTREE_RANDOM_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/* xoroshiro256++ stream with its own state, so that each caller (or thread)
+ * draws from an independent, reproducible sequence. Same algorithm as the
+ * xoroshiro256plusplus generator used by the point generators. */
+typedef struct {
+    uint64_t s[4];
+} kd_random_t;
+
+static inline uint64_t __KDT_random_rotl(const uint64_t x, const int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* expands a 64-bit seed into the generator state with splitmix64 */
+static inline void KDT_random_seed(kd_random_t* rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += UINT64_C(0x9E3779B97F4A7C15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+        rng->s[i] = z ^ (z >> 31);
+    }
+}
+
+static inline uint64_t KDT_random_next(kd_random_t* rng)
+{
+    uint64_t* s = rng->s;
+    const uint64_t result = __KDT_random_rotl(s[0] + s[3], 23) + s[0];
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = __KDT_random_rotl(s[3], 45);
+
+    return result;
+}
+
+/* uniform double in [0, 1) */
+static inline double KDT_random_uniform(kd_random_t* rng)
+{
+    return (KDT_random_next(rng) >> 11) * 0x1.0p-53;
+}
+
+/* uniform integer in [0, n), for n < 2^53 */
+static inline uint64_t KDT_random_bounded(kd_random_t* rng, const uint64_t n)
+{
+    return (uint64_t) (KDT_random_uniform(rng) * n);
+}
+
+/* standard normal deviate (Box-Muller, two uniform draws) */
+static inline double KDT_random_normal(kd_random_t* rng)
+{
+    double u = KDT_random_uniform(rng);
+    double v = KDT_random_uniform(rng);
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+/* advances the stream by 2^128 draws: successive jumps of one seed give
+ * non-overlapping streams, e.g. one per thread or per block of work */
+static inline void KDT_random_jump(kd_random_t* rng)
+{
+    static const uint64_t JUMP[] = { UINT64_C(0x180ec6d33cfd0aba), UINT64_C(0xd5a61266f0c9392c),
+                                     UINT64_C(0xa9582618e03fc9aa), UINT64_C(0x39abdc4529b1661c) };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (JUMP[i] & (UINT64_C(1) << b)) {
+                s0 ^= rng->s[0];
+                s1 ^= rng->s[1];
+                s2 ^= rng->s[2];
+                s3 ^= rng->s[3];
+            }
+            KDT_random_next(rng);
+        }
+    }
+    rng->s[0] = s0;
+    rng->s[1] = s1;
+    rng->s[2] = s2;
+    rng->s[3] = s3;
+}
+
+/* advances the stream by 2^192 draws: each long jump starts a range of 2^64
+ * streams that KDT_random_jump can hand out without overlapping the next one */
+static inline void KDT_random_long_jump(kd_random_t* rng)
+{
+    static const uint64_t LONG_JUMP[] = { UINT64_C(0x76e15d3efefdcbbf), UINT64_C(0xc5004e441c522fb3),
+                                          UINT64_C(0x77710069854ee241), UINT64_C(0x39109bb02acbe635) };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (LONG_JUMP[i] & (UINT64_C(1) << b)) {
+                s0 ^= rng->s[0];
+                s1 ^= rng->s[1];
+                s2 ^= rng->s[2];
+                s3 ^= rng->s[3];
+            }
+            KDT_random_next(rng);
+        }
+    }
+    rng->s[0] = s0;
+    rng->s[1] = s1;
+    rng->s[2] = s2;
+    rng->s[3] = s3;
+}
+
+#define KDT_RANDOM_LANES 4
+
+/* KDT_RANDOM_LANES interleaved xoroshiro256++ streams for batch generation.
+ * The state is stored word by word (s[w][lane]) so that one SIMD register
+ * holds the same word of every lane. */
+typedef struct {
+    uint64_t s[4][KDT_RANDOM_LANES];
+} kd_random4_t;
+
+/* lane l starts at rng advanced by l jumps */
+void KDT_random4_init(kd_random4_t* rng4, const kd_random_t* rng);
+
+/* raw 64-bit draws: out[i] comes from lane i % KDT_RANDOM_LANES. The AVX2 and
+ * scalar paths produce the same values */
+void KDT_random4_fill(kd_random4_t* rng4, uint64_t* out, size_t n);
+
+/* uniform doubles in [0, 1), converted as KDT_random_uniform does */
+void KDT_random4_uniform(kd_random4_t* rng4, double* out, size_t n);
+
+/* standard normal deviates (256-layer ziggurat over the raw draws) */
+void KDT_random4_normal(kd_random4_t* rng4, double* out, size_t n);
+
+#endif // _KDTREE_RANDOM_
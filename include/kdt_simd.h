@@ -0,0 +1,55 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#ifndef _KDTREE_SIMD_
+#define _KDTREE_SIMD_
+
+// Caminhos SIMD escolhidos em tempo de execução: cada núcleo vetorial é compilado
+// com o atributo target da sua extensão e só é chamado se a CPU a tem, de modo que
+// o mesmo binário roda em qualquer x86-64 sem -march. Em outros compiladores ou
+// arquiteturas, só os caminhos escalares existem.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KDT_X86_SIMD 1
+
+#include <immintrin.h>
+
+#define KDT_TARGET_AVX2 __attribute__((target("avx2")))
+#define KDT_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512vl")))
+
+static inline int KDT_cpu_has_avx2( void )
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static inline int KDT_cpu_has_avx512( void )
+{
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+// Força a expansão de um laço genérico dentro de cada versão com atributo target
+#if defined(__GNUC__)
+#define KDT_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define KDT_ALWAYS_INLINE inline
+#endif
+
+#endif
@@ -24,32 +24,147 @@ Author: Célestin Marot (celestin.marot@uclouvain.be)                        */
 
 #include <hxt_tetrahedra.h>
 
-// Estrutura que representa uma árvore-KD.
-typedef struct kd_node_t_struct {
-    int id;
-	vertex_t* vertex;				        // Ponto associado ao nó da árvore.
-	//int axis;			                    // Campo que indica a dimensão pela qual a árvore KD divide o conjunto de pontos.
-	struct kd_node_t_struct *esquerdo;		// Ponteiro para o filho esquerdo da Árvore KD.
-	struct kd_node_t_struct *direito;		// Ponteiro para o filho direito da Árvore KD.
+// Posição da mediana numa fatia de n pontos particionada pela mediana.
+#define KDT_MEDIAN(n) (((n) - 1)/2)
+
+// Visão de um nó da árvore-KD implícita. A árvore não é alocada: o próprio array
+// de vértices, particionado pela mediana, é a árvore. Cada nó é uma fatia
+// [vertices, vertices + n) cujo ponto fica em KDT_MEDIAN(n), a subárvore esquerda
+// à sua esquerda e a subárvore direita à sua direita.
+typedef struct {
+	vertex_t* vertices;		// Início da fatia que contém a subárvore.
+	uint32_t n;				// Número de pontos da subárvore (0 para um nó vazio).
 } kd_node_t;
 
-// Estrutura para representar um nó da fila
-typedef struct queue_node_t_struct {
-	kd_node_t* node;
-	struct queue_node_t_struct* next;
-} queue_node_t;
+static inline int KDT_node_is_empty(kd_node_t node)
+{
+	return node.n == 0;
+}
+
+// Ponto associado ao nó (a mediana da fatia).
+static inline vertex_t* KDT_node_vertex(kd_node_t node)
+{
+	return node.vertices + KDT_MEDIAN(node.n);
+}
+
+// Filho esquerdo: os pontos antes da mediana.
+static inline kd_node_t KDT_node_left(kd_node_t node)
+{
+	kd_node_t left = { node.vertices, KDT_MEDIAN(node.n) };
+	return left;
+}
+
+// Filho direito: os pontos depois da mediana.
+static inline kd_node_t KDT_node_right(kd_node_t node)
+{
+	kd_node_t right = { node.vertices + KDT_MEDIAN(node.n) + 1, node.n/2 };
+	return right;
+}
+
+// Ordem dos pontos dentro de uma subárvore que sai inteira na ordem híbrida
+typedef enum {
+	KDT_PREORDER,		// Em profundidade: o ponto do nó, a subárvore esquerda e a direita.
+	KDT_INORDER			// Em ordem: a fatia do array como está.
+} kd_subtree_order_t;
+
+// Curva que ordena os nós de cada nível da ordem em largura
+typedef enum {
+	KDT_CURVE_NONE,		// Ordem da fila: esquerda antes da direita.
+	KDT_CURVE_MORTON,	// Curva de Morton (ordem Z) dos pontos dos nós.
+	KDT_CURVE_HILBERT	// Curva de Hilbert dos pontos dos nós.
+} kd_curve_t;
+
+// Política que escolhe o eixo de corte de cada nó (o corte é sempre na mediana)
+typedef enum {
+	KDT_SPLIT_LONGEST_EDGE,		// Maior aresta da célula dos planos de corte.
+	KDT_SPLIT_TIGHT_BBOX,		// Maior aresta da bbox justa dos pontos do nó.
+	KDT_SPLIT_MAX_VARIANCE,		// Eixo de maior variância dos pontos do nó.
+	KDT_SPLIT_SLIDING_MIDPOINT,	// Entre as arestas mais longas da célula, a de maior espalhamento.
+	KDT_SPLIT_PCA				// Direção principal dos pontos (nós com ao menos pca_size pontos).
+} kd_split_policy_t;
+
+// Opções da ordenação. Um ponteiro NULL equivale às opções de KDT_options_init.
+typedef struct {
+	int num_threads;		// Número de threads (0 usa o padrão do OpenMP).
+	uint32_t grain_size;	// Subárvores menores que isto não geram novas tarefas.
+	uint32_t partition_size;	// Fatias a partir deste tamanho são particionadas por todas as threads.
+	uint64_t seed;			// Semente dos sorteios da seleção: a mesma semente reproduz a mesma árvore.
+	int multiway_levels;	// Níveis construídos por passada de distribuição (0 desliga o modo multi-vias).
+	double brio_ratio;		// Razão entre os tamanhos de rodadas consecutivas do BRIO (<= 1: uma só rodada).
+	uint32_t brio_first_round;	// Tamanho mínimo da primeira rodada do BRIO.
+	int bfs_levels;			// Níveis em ordem de largura; abaixo deles, cada subárvore sai inteira (< 0: todos).
+	uint32_t bucket_size;	// Subárvores com até este número de pontos saem inteiras (0: nenhuma).
+	kd_subtree_order_t subtree_order;	// Ordem dos pontos de uma subárvore que sai inteira.
+	kd_curve_t level_curve;	// Curva que ordena os nós (ou subárvores inteiras) de cada nível.
+	kd_split_policy_t split_policy;	// Escolha do eixo de corte (fora da maior aresta, desliga o modo multi-vias).
+	uint32_t pca_size;		// Nós menores que isto cortam pela bbox justa no modo KDT_SPLIT_PCA.
+	int in_place;			// Reordena os pontos no próprio array, sem o buffer de n pontos (mais lento).
+	int level_sync;			// Constrói nível a nível, escrevendo as medianas de cada nível (só na ordem em largura).
+} kd_options_t;
+
+void KDT_options_init(kd_options_t* options);
 
-// Estrutura para representar uma fila
+// Array de dados por ponto do chamador, reordenado junto com os pontos.
 typedef struct {
-	queue_node_t* front;
-	queue_node_t* rear;
-} Queue;
+	void* data;			// Dados do primeiro ponto.
+	size_t stride;		// Bytes entre os dados de pontos consecutivos.
+	size_t size;		// Bytes movidos por ponto (<= stride).
+} kd_attribute_t;
+
+/* builds the kd-tree in place: on return, vertices is laid out as an implicit tree */
+kd_node_t KDT_vertices_build_kdtree(bbox_t bbox, vertex_t* vertices, const uint32_t n, const kd_options_t* options);
+
+/* biased randomized insertion order using a kd-tree: with options->brio_ratio > 1,
+ * the points are drawn into geometric rounds and each round is kd-sorted */
+status_t KDT_vertices_BRIO(bbox_t bbox, vertex_t* vertices, uint32_t n, const kd_options_t* options);
+
+/* KDT_vertices_BRIO that also reorders num_attributes caller arrays like the points.
+ * If not NULL, order[i] receives the original index of the i-th output point and
+ * inverse[j] the output position of the original point j. The dist field of the
+ * points carries their index during the sort and is restored afterwards */
+status_t KDT_vertices_BRIO_attributes(bbox_t bbox, vertex_t* vertices, uint32_t n,
+                                      const kd_attribute_t* attributes, int num_attributes,
+                                      uint32_t* order, uint32_t* inverse, const kd_options_t* options);
+
+// Ordenação preguiçosa, nível a nível (ver KDT_stream_create).
+typedef struct kd_stream kd_stream_t;
+
+/* lazy KDT_vertices_BRIO order: each call to KDT_stream_next_level partitions one more
+ * kd-tree level and returns its points (breadth-first, round after round). vertices is
+ * the workspace and is reordered; output receives the order, or, if NULL, the stream
+ * keeps a buffer that only grows with the levels requested. The hybrid orders and the
+ * multi-way mode are not used */
+status_t KDT_stream_create(kd_stream_t** stream, bbox_t bbox, vertex_t* vertices, uint32_t n,
+                           vertex_t* output, const kd_options_t* options);
+
+/* partitions the next level: level[0, count) are the next count points of the order
+ * (count == 0 once the order is complete). level is valid until the next call */
+status_t KDT_stream_next_level(kd_stream_t* stream, const vertex_t** level, uint32_t* count);
+
+/* number of points of the order produced so far */
+uint32_t KDT_stream_done(const kd_stream_t* stream);
+
+/* stops the stream, possibly before the order is complete */
+status_t KDT_stream_destroy(kd_stream_t** stream);
+
+/* kd-tree order as a permutation: order[i] is the index of the i-th point to insert.
+ * The points (coord[0..2] every stride bytes, in any caller layout) are left untouched:
+ * the top of the tree is built on packed keys (the cut coordinate and a 32-bit index,
+ * 12 bytes per point) read back from coord at each node, and only subtrees small
+ * enough for the cache are copied into vertex_t records. multiway_levels, level_sync
+ * and in_place do not apply; the tree is the same */
+status_t KDT_vertices_order(bbox_t bbox, const double* coord, size_t stride, uint32_t n, uint32_t* order, const kd_options_t* options);
+
+/* bounding box of the points (empty box for n == 0), reduced with vectorized
+ * min/max by options->num_threads threads */
+status_t KDT_vertices_bbox(const vertex_t* vertices, uint32_t n, bbox_t* bbox, const kd_options_t* options);
 
-kd_node_t *KDT_vertices_build_kdtree(bbox_t bbox, vertex_t* vertices, const uint32_t n);
+/* mean distance between consecutive points, a measure of how far the insertion jumps */
+double KDT_vertices_mean_distance(const vertex_t* vertices, uint32_t n);
 
-/* biased randomized insertion order using a kd-tree */
-status_t KDT_vertices_BRIO(bbox_t bbox, vertex_t* vertices, uint32_t n);
+/* applies a permutation in place: vertices[i] receives the old vertices[order[i]] */
+status_t KDT_vertices_permute(vertex_t* vertices, uint32_t n, const uint32_t* order);
 
-void desenha_arvore(kd_node_t *root, const char *filename);
+void desenha_arvore(kd_node_t root, const char *filename);
 
 #endif
@@ -0,0 +1,1075 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+// Arquivos maiores que 2 GiB também em sistemas de 32 bits
+#define _FILE_OFFSET_BITS 64
+
+#include <float.h>
+#include <math.h>
+#include <sys/types.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <kdt_external.h>
+#include <kdt_io.h>
+#include <kdt_random.h>
+
+#define MAX3_IDX(a,b,c) (((a) > (b))?(((a) > (c))?0:2):(((b) > (c))?1:2))
+
+// Orçamento padrão e mínimo de memória
+#define KDT_EXTERNAL_DEFAULT_BUDGET ((size_t) 1 << 30)
+#define KDT_EXTERNAL_MIN_BUDGET ((size_t) 16 << 20)
+
+// Bytes por ponto de uma célula ordenada em memória: o ponto, o buffer da ordem em
+// largura e os vetores auxiliares do BRIO
+#define KDT_EXTERNAL_BYTES_PER_POINT 80
+
+// Pontos lidos de cada vez nas passadas sobre uma faixa
+#define KDT_EXTERNAL_CHUNK 65536
+
+// Amostra dos divisores da seleção: pontos contíguos por leitura
+#define KDT_EXTERNAL_SAMPLE_BLOCK 1024
+
+// Níveis de medianas exatas escolhidos numa faixa antes de distribuí-la
+#define KDT_EXTERNAL_MAX_LEVELS 12
+
+// Filho dos nós da árvore global que são células
+#define KDT_EXTERNAL_CELL UINT32_MAX
+
+// Faixa de registros de um arquivo: a entrada .kdp (o índice original é a posição do
+// registro) ou um arquivo temporário (vertex_t, com o índice original em dist)
+typedef struct {
+	FILE* file;
+	int input;
+	uint64_t first;
+	uint64_t n;
+} kd_extent_t;
+
+// Nó da árvore global. Acima das células, um nó com a sua mediana exata; embaixo, uma
+// célula, ordenada em largura na memória e guardada de volta na sua faixa do temporário
+typedef struct {
+	vertex_t median;
+	uint32_t child[2];		// KDT_EXTERNAL_CELL nas células
+	FILE* file;
+	uint64_t first;
+	uint64_t n;
+} kd_ext_node_t;
+
+typedef struct {
+	FILE* output;
+	FILE* index;
+	uint64_t input_offset;	// Bytes do cabeçalho da entrada
+	uint32_t input_stride;
+	uint64_t cap;			// Pontos de uma célula que cabem na memória
+	size_t budget;
+	int num_threads;
+	kd_options_t kd;		// Ordem em largura de cada célula
+	kd_random_t rng;		// Amostras da seleção
+	FILE* scratch[2];		// Temporários das distribuições, alternados por nível
+	kd_ext_node_t* nodes;
+	uint32_t num_nodes;
+} kd_external_t;
+
+// Topo da árvore de uma faixa grande demais: levels níveis de nós em ordem de heap
+// (raiz em 1), seguidos das células da distribuição. O tamanho de cada nó só depende
+// do tamanho da faixa; o eixo de corte e a mediana exata são escolhidos nível a nível
+typedef struct {
+	int levels;
+	uint64_t* n;
+	bbox_t* box;
+	int* axis;
+	vertex_t* median;
+} kd_top_t;
+
+// Seleção da mediana de um nó: ela está na faixa de chaves (lo, hi], que cada passada
+// estreita contando os pontos entre os divisores da faixa. Sem divisores, a passada
+// sorteia alguns pontos da faixa; quando a faixa cabe na memória, a passada recolhe
+// os seus pontos e a mediana sai de uma ordenação
+typedef enum {
+	KDT_SELECT_COUNT,
+	KDT_SELECT_SAMPLE,
+	KDT_SELECT_COLLECT,
+	KDT_SELECT_DONE
+} kd_select_mode_t;
+
+typedef struct {
+	kd_select_mode_t mode;
+	int active;				// O nó participa da passada atual
+	int has_lo;
+	int has_hi;
+	vertex_t lo;
+	vertex_t hi;
+	uint64_t rank;			// Posição da mediana no nó
+	uint64_t below;			// Pontos do nó até lo
+	uint64_t inside;		// Pontos do nó em (lo, hi]
+	uint64_t split;			// Divisores ordenados, em split[split .. split + num_split)
+	uint64_t num_split;
+	uint64_t count;			// Pontos entre os divisores, em count[count .. count + num_split]
+	uint64_t window;		// Estimativa dos pontos entre o primeiro e o último divisor
+	uint64_t reservoir;		// Amostra da faixa, em split[reservoir ..), e o seu tamanho
+	uint64_t num_reservoir;
+	uint64_t seen;
+	uint64_t collect;		// Pontos recolhidos, em collect[collect .. collect + fill)
+	uint64_t fill;
+	uint64_t reserve;		// Espaço para recolher os pontos da janela enquanto conta (0: não recolhe)
+} kd_select_t;
+
+// Memória da seleção de uma faixa
+typedef struct {
+	vertex_t* sample;
+	uint64_t num_sample;
+	vertex_t* split[2];		// Divisores em uso e amostras para a próxima passada
+	uint64_t split_cap;
+	uint64_t* count;
+	vertex_t* collect;
+	uint64_t collect_cap;
+	vertex_t* chunk;
+	uint32_t* node;
+	uint32_t* bucket;
+	kd_select_t* sel;
+} kd_select_work_t;
+
+void KDT_external_options_init(kd_external_options_t* options)
+{
+	options->memory_budget = KDT_EXTERNAL_DEFAULT_BUDGET;
+	KDT_options_init(&options->kd_options);
+}
+
+// Ordem total ao longo de um eixo: a coordenada e, nos empates, o índice original.
+// É a ordem das medianas exatas, que assim separam também pontos repetidos
+static inline int __KDT_external_less(const vertex_t* a, const vertex_t* b, const int axis)
+{
+	// Sem desvios: o resultado é imprevisível nas passadas de seleção
+	return (a->coord[axis] < b->coord[axis]) | ((a->coord[axis] == b->coord[axis]) & (a->dist < b->dist));
+}
+
+static inline int __KDT_external_compare(const void* a, const void* b, const int axis)
+{
+	const vertex_t* u = (const vertex_t*) a;
+	const vertex_t* v = (const vertex_t*) b;
+	return __KDT_external_less(u, v, axis) ? -1 : __KDT_external_less(v, u, axis);
+}
+
+static int __KDT_external_compare_x(const void* a, const void* b) { return __KDT_external_compare(a, b, 0); }
+static int __KDT_external_compare_y(const void* a, const void* b) { return __KDT_external_compare(a, b, 1); }
+static int __KDT_external_compare_z(const void* a, const void* b) { return __KDT_external_compare(a, b, 2); }
+
+static void __KDT_external_sort_keys(vertex_t* v, const uint64_t n, const int axis)
+{
+	static int (* const compare[3])(const void*, const void*) = {
+		__KDT_external_compare_x, __KDT_external_compare_y, __KDT_external_compare_z
+	};
+	qsort(v, n, sizeof(vertex_t), compare[axis]);
+}
+
+// Lê os registros [first, first + n) da faixa em v
+static status_t __KDT_external_read(const kd_external_t* ex, const kd_extent_t* ext, const uint64_t first,
+                                    const uint64_t n, vertex_t* v)
+{
+	const size_t size = ext->input ? ex->input_stride : sizeof(vertex_t);
+	const uint64_t offset = ext->input ? ex->input_offset : 0;
+	if ( fseeko(ext->file, (off_t) (offset + (ext->first + first)*size), SEEK_SET) != 0
+	  || fread(v, size, n, ext->file) != n )
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading points");
+
+	if ( !ext->input )
+		return HXT_STATUS_OK;
+
+	// Registros x y z foram lidos compactados no início de v: expande de trás para
+	// frente, que cada ponto só sobrescreve registros já expandidos. O índice
+	// original é a posição do registro
+	const double* packed = (const double*) v;
+	for (uint64_t i = n; i-- > 0; )
+	{
+		if ( size == 3*sizeof(double) ) {
+			const double x = packed[3*i], y = packed[3*i + 1], z = packed[3*i + 2];
+			v[i].coord[0] = x;
+			v[i].coord[1] = y;
+			v[i].coord[2] = z;
+		}
+		v[i].dist = ext->first + first + i;
+	}
+
+	return HXT_STATUS_OK;
+}
+
+// Escreve pontos na saída (e os índices originais); v é compactado no lugar
+static status_t __KDT_external_write(const kd_external_t* ex, vertex_t* v, const uint64_t n)
+{
+	if ( ex->index != NULL )
+	{
+		uint64_t staging[4096];
+		for (uint64_t i = 0; i < n; i += 4096)
+		{
+			const uint64_t m = n - i < 4096 ? n - i : 4096;
+			for (uint64_t j = 0; j < m; j++)
+				staging[j] = v[i + j].dist;
+			if ( fwrite(staging, sizeof(uint64_t), m, ex->index) != m )
+				return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing the point indices");
+		}
+	}
+
+	// Compacta as coordenadas no lugar, da frente para trás
+	double* packed = (double*) v;
+	for (uint64_t i = 0; i < n; i++)
+		memmove(packed + 3*i, v[i].coord, 3*sizeof(double));
+
+	if ( fwrite(packed, 3*sizeof(double), n, ex->output) != n )
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing the sorted points");
+
+	return HXT_STATUS_OK;
+}
+
+// Ordena em largura, na memória, uma faixa que cabe no orçamento e a guarda de volta
+// no mesmo lugar do temporário (ou na saída, se a faixa é a entrada toda)
+static status_t __KDT_external_sort_cell(const kd_external_t* ex, const kd_extent_t* ext, const bbox_t box)
+{
+	const uint64_t n = ext->n;
+	if ( n == 0 )
+		return HXT_STATUS_OK;
+
+	vertex_t* v = NULL;
+	HXT_CHECK( HXT_malloc(&v, n*sizeof(vertex_t)) );
+
+	status_t status = __KDT_external_read(ex, ext, 0, n, v);
+	if ( status == HXT_STATUS_OK )
+		status = KDT_vertices_BRIO(box, v, (uint32_t) n, &ex->kd);
+
+	if ( status == HXT_STATUS_OK && ext->input )
+		status = __KDT_external_write(ex, v, n);
+	else if ( status == HXT_STATUS_OK )
+	{
+		if ( fseeko(ext->file, (off_t) (ext->first*sizeof(vertex_t)), SEEK_SET) != 0
+		  || fwrite(v, sizeof(vertex_t), n, ext->file) != n )
+			status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing a temporary file");
+	}
+
+	HXT_free(&v);
+	return status;
+}
+
+// Lê uma amostra de até *s pontos espalhada pela faixa, em blocos contíguos
+static status_t __KDT_external_sample(const kd_external_t* ex, const kd_extent_t* ext, vertex_t* sample,
+                                      uint64_t* s)
+{
+	if ( *s > ext->n )
+		*s = ext->n;
+
+	const uint64_t num_blocks = (*s + KDT_EXTERNAL_SAMPLE_BLOCK - 1)/KDT_EXTERNAL_SAMPLE_BLOCK;
+	uint64_t read = 0;
+	for (uint64_t b = 0; b < num_blocks && read < *s; b++)
+	{
+		uint64_t first = ext->n*b/num_blocks;
+		const uint64_t m = KDT_EXTERNAL_SAMPLE_BLOCK < *s - read ? KDT_EXTERNAL_SAMPLE_BLOCK : *s - read;
+		if ( first + m > ext->n )
+			first = ext->n - m;
+
+		HXT_CHECK( __KDT_external_read(ex, ext, first, m, sample + read) );
+		read += m;
+	}
+
+	return HXT_STATUS_OK;
+}
+
+// Pontos do nível level da ordem em largura de uma subárvore de n pontos. Um nó de m
+// pontos tem filhos de (m-1)/2 e m/2 pontos, logo os nós de cada nível têm no máximo
+// dois tamanhos, que diferem de um
+static uint64_t __KDT_external_level_size(const uint64_t n, const int level)
+{
+	uint64_t size[2] = { n, 0 };
+	uint64_t count[2] = { 1, 0 };
+	for (int l = 0; l < level; l++)
+	{
+		uint64_t next_size[2] = { 0, 0 };
+		uint64_t next_count[2] = { 0, 0 };
+		for (int i = 0; i < 2; i++)
+		{
+			if ( count[i] == 0 || size[i] == 0 )
+				continue;
+
+			const uint64_t child[2] = { (size[i] - 1)/2, size[i]/2 };
+			for (int j = 0; j < 2; j++)
+			{
+				if ( child[j] == 0 )
+					continue;
+				const int k = next_count[0] == 0 || next_size[0] == child[j] ? 0 : 1;
+				next_size[k] = child[j];
+				next_count[k] += count[i];
+			}
+		}
+		memcpy(size, next_size, sizeof(size));
+		memcpy(count, next_count, sizeof(count));
+	}
+	return (size[0] > 0 ? count[0] : 0) + count[1];
+}
+
+// Nó do nível l do topo em que cai o ponto p, ou 0 se p é a mediana de um nível acima
+static inline uint32_t __KDT_external_node(const kd_top_t* top, const int l, const vertex_t* p)
+{
+	uint32_t c = 1;
+	for (int d = 0; d < l; d++)
+	{
+		const vertex_t* median = &top->median[c];
+		if ( p->dist == median->dist )
+			return 0;
+		c = 2*c + __KDT_external_less(median, p, top->axis[c]);
+	}
+	return c;
+}
+
+static inline int __KDT_external_inside(const kd_select_t* s, const vertex_t* p, const int axis)
+{
+	return ((!s->has_lo) | __KDT_external_less(&s->lo, p, axis))
+	     & ((!s->has_hi) | !__KDT_external_less(&s->hi, p, axis));
+}
+
+// Intervalo entre os divisores em que cai p: o primeiro divisor >= p. Quase todos os
+// pontos caem fora da janela, nos intervalos das pontas
+static inline uint32_t __KDT_external_bucket(const vertex_t* split, const uint64_t num_split, const vertex_t* p,
+                                             const int axis)
+{
+	const int after_first = __KDT_external_less(&split[0], p, axis);
+	const int after_last = __KDT_external_less(&split[num_split - 1], p, axis);
+	if ( after_first == after_last )
+		return after_last ? (uint32_t) num_split : 0;
+
+	uint64_t lo = 1, hi = num_split - 1;
+	while ( lo < hi )
+	{
+		const uint64_t mid = lo + (hi - lo)/2;
+		if ( __KDT_external_less(&split[mid], p, axis) )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (uint32_t) lo;
+}
+
+// Janela dos divisores ordenados de um nó em torno da posição esperada da mediana,
+// com folga de quatro desvios padrão da amostra: os pontos fora da janela caem nos
+// intervalos das pontas sem busca, e a mediana fica fora dela só muito raramente
+static void __KDT_external_window(kd_select_t* s)
+{
+	if ( s->num_split == 0 )
+		return;
+
+	const double q = (double) (s->rank - s->below)/s->inside;
+	const double expected = q*s->num_split;
+	const double margin = 4.0*sqrt(s->num_split*q*(1.0 - q)) + 16.0;
+
+	const double lo = expected - margin;
+	const double hi = expected + margin;
+	const uint64_t first = lo > 0.0 ? (uint64_t) lo : 0;
+	const uint64_t last = hi < (double) s->num_split ? (uint64_t) hi : s->num_split;
+	s->window = last > first ? (uint64_t) ((double) s->inside*(last - first - 1)/(s->num_split + 1)) : 0;
+	s->split += first;
+	s->num_split = last - first;
+}
+
+// Modo seguinte de um nó cuja faixa foi estreitada
+static inline kd_select_mode_t __KDT_external_next_mode(const kd_select_t* s, const kd_select_work_t* w)
+{
+	if ( s->inside <= w->collect_cap )
+		return KDT_SELECT_COLLECT;
+	return s->num_split > 0 ? KDT_SELECT_COUNT : KDT_SELECT_SAMPLE;
+}
+
+// Uma passada sobre a faixa para os nós ativos do nível l
+static status_t __KDT_external_select_pass(kd_external_t* ex, const kd_extent_t* ext, const kd_top_t* top,
+                                           const int l, kd_select_work_t* w, const int p)
+{
+	const uint32_t base = 1u << l;
+	kd_select_t* sel = w->sel;
+
+	for (uint64_t i = 0; i < ext->n; i += KDT_EXTERNAL_CHUNK)
+	{
+		const uint64_t m = ext->n - i < KDT_EXTERNAL_CHUNK ? ext->n - i : KDT_EXTERNAL_CHUNK;
+		HXT_CHECK( __KDT_external_read(ex, ext, i, m, w->chunk) );
+
+		// Nó e intervalo de cada ponto, em paralelo
+		#pragma omp parallel for num_threads(ex->num_threads) if(m > 4096)
+		for (uint64_t j = 0; j < m; j++)
+		{
+			const vertex_t* q = &w->chunk[j];
+			const uint32_t c = __KDT_external_node(top, l, q);
+			w->node[j] = UINT32_MAX;
+			if ( c == 0 || !sel[c - base].active || !__KDT_external_inside(&sel[c - base], q, top->axis[c]) )
+				continue;
+
+			const kd_select_t* s = &sel[c - base];
+			w->node[j] = c - base;
+			w->bucket[j] = s->mode == KDT_SELECT_COUNT ? __KDT_external_bucket(w->split[p] + s->split, s->num_split, q, top->axis[c]) : 0;
+		}
+
+		for (uint64_t j = 0; j < m; j++)
+		{
+			if ( w->node[j] == UINT32_MAX )
+				continue;
+
+			kd_select_t* s = &sel[w->node[j]];
+			switch ( s->mode )
+			{
+				case KDT_SELECT_COUNT:
+				{
+					const uint32_t b = w->bucket[j];
+					w->count[s->count + b]++;
+					if ( b > 0 && b < s->num_split && s->reserve > 0 ) {
+						if ( s->fill < s->reserve )
+							w->collect[s->collect + s->fill] = w->chunk[j];
+						s->fill++;
+					}
+					break;
+				}
+
+				case KDT_SELECT_SAMPLE:
+				{
+					// Amostragem de reservatório
+					const uint64_t r = s->seen < s->num_reservoir ? s->seen : KDT_random_bounded(&ex->rng, s->seen + 1);
+					if ( r < s->num_reservoir )
+						w->split[p ^ 1][s->reservoir + r] = w->chunk[j];
+					s->seen++;
+					break;
+				}
+
+				case KDT_SELECT_COLLECT:
+					if ( s->fill == s->inside )
+						return HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+					w->collect[s->collect + s->fill++] = w->chunk[j];
+					break;
+
+				default:
+					break;
+			}
+		}
+	}
+
+	return HXT_STATUS_OK;
+}
+
+// Medianas exatas do nível l do topo
+static status_t __KDT_external_select_level(kd_external_t* ex, const kd_extent_t* ext, kd_top_t* top,
+                                            const int l, kd_select_work_t* w)
+{
+	const uint32_t base = 1u << l;
+	kd_select_t* sel = w->sel;
+	int p = 0;
+
+	// Divisores iniciais: os pontos da amostra que caem em cada nó, na ordem do eixo do nó
+	for (uint32_t j = 0; j < base; j++) {
+		memset(&sel[j], 0, sizeof(kd_select_t));
+		sel[j].rank = (top->n[base + j] - 1)/2;
+		sel[j].inside = top->n[base + j];
+	}
+
+	for (uint64_t i = 0; i < w->num_sample; i++) {
+		const uint32_t c = __KDT_external_node(top, l, &w->sample[i]);
+		w->node[i] = c;
+		if ( c != 0 )
+			sel[c - base].num_split++;
+	}
+
+	uint64_t offset = 0;
+	for (uint32_t j = 0; j < base; j++) {
+		sel[j].split = offset;
+		offset += sel[j].num_split;
+		sel[j].num_split = 0;
+	}
+	for (uint64_t i = 0; i < w->num_sample; i++) {
+		if ( w->node[i] != 0 ) {
+			kd_select_t* s = &sel[w->node[i] - base];
+			w->split[p][s->split + s->num_split++] = w->sample[i];
+		}
+	}
+	for (uint32_t j = 0; j < base; j++) {
+		__KDT_external_sort_keys(w->split[p] + sel[j].split, sel[j].num_split, top->axis[base + j]);
+		__KDT_external_window(&sel[j]);
+		sel[j].mode = __KDT_external_next_mode(&sel[j], w);
+	}
+
+	for (;;)
+	{
+		// Plano da passada: todos os nós que contam, e os que amostram ou recolhem
+		// enquanto houver memória para eles
+		uint32_t num_sampling = 0;
+		for (uint32_t j = 0; j < base; j++)
+			num_sampling += sel[j].mode == KDT_SELECT_SAMPLE;
+
+		uint64_t reservoir = num_sampling > 0 ? w->split_cap/num_sampling : 0;
+		if ( reservoir < 2 )
+			reservoir = 2;
+
+		uint64_t counted = 0, sampled = 0, collected = 0;
+		int pending = 0;
+		for (uint32_t j = 0; j < base; j++)
+		{
+			kd_select_t* s = &sel[j];
+			s->active = 0;
+			if ( s->mode == KDT_SELECT_DONE )
+				continue;
+
+			pending = 1;
+			if ( s->mode == KDT_SELECT_COUNT ) {
+				s->active = 1;
+				s->count = counted;
+				memset(w->count + counted, 0, (s->num_split + 1)*sizeof(uint64_t));
+				counted += s->num_split + 1;
+
+				// Recolhe a janela na mesma passada se couber, com folga para a estimativa
+				s->fill = 0;
+				s->reserve = 2*s->window + 64;
+				if ( collected + s->reserve <= w->collect_cap ) {
+					s->collect = collected;
+					collected += s->reserve;
+				}
+				else
+					s->reserve = 0;
+			}
+			else if ( s->mode == KDT_SELECT_SAMPLE && sampled + reservoir <= w->split_cap ) {
+				s->active = 1;
+				s->reservoir = sampled;
+				s->num_reservoir = reservoir;
+				s->seen = 0;
+				sampled += reservoir;
+			}
+			else if ( s->mode == KDT_SELECT_COLLECT && collected + s->inside <= w->collect_cap ) {
+				s->active = 1;
+				s->collect = collected;
+				s->fill = 0;
+				collected += s->inside;
+			}
+		}
+
+		if ( !pending )
+			return HXT_STATUS_OK;
+
+		HXT_CHECK( __KDT_external_select_pass(ex, ext, top, l, w, p) );
+
+		// Estreita as faixas, troca os divisores pelas amostras e escolhe as medianas
+		for (uint32_t j = 0; j < base; j++)
+		{
+			kd_select_t* s = &sel[j];
+			if ( !s->active )
+				continue;
+
+			const int axis = top->axis[base + j];
+			if ( s->mode == KDT_SELECT_COUNT )
+			{
+				const uint64_t* count = w->count + s->count;
+				const vertex_t* split = w->split[p] + s->split;
+				uint64_t before = 0, b = 0;
+				while ( b < s->num_split && before + count[b] <= s->rank - s->below )
+					before += count[b++];
+
+				uint64_t total = before;
+				for (uint64_t k = b; k <= s->num_split; k++)
+					total += count[k];
+				if ( total != s->inside )
+					return HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+
+				// A janela recolhida contém o intervalo da mediana: a mediana sai dela
+				if ( s->reserve > 0 && s->fill <= s->reserve && b > 0 && b < s->num_split )
+				{
+					if ( s->fill != s->inside - count[0] - count[s->num_split] )
+						return HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+
+					vertex_t* v = w->collect + s->collect;
+					__KDT_external_sort_keys(v, s->fill, axis);
+					top->median[base + j] = v[s->rank - s->below - count[0]];
+					s->mode = KDT_SELECT_DONE;
+					continue;
+				}
+
+				if ( b > 0 ) {
+					s->lo = split[b - 1];
+					s->has_lo = 1;
+				}
+				if ( b < s->num_split ) {
+					s->hi = split[b];
+					s->has_hi = 1;
+				}
+				s->below += before;
+				s->inside = count[b];
+				s->num_split = 0;
+				s->mode = __KDT_external_next_mode(s, w);
+			}
+			else if ( s->mode == KDT_SELECT_SAMPLE )
+			{
+				if ( s->seen != s->inside )
+					return HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+
+				// A amostra vira os divisores da próxima passada, que lê split[p ^ 1]
+				s->split = s->reservoir;
+				s->num_split = s->num_reservoir < s->seen ? s->num_reservoir : s->seen;
+				__KDT_external_sort_keys(w->split[p ^ 1] + s->split, s->num_split, axis);
+				__KDT_external_window(s);
+				s->mode = KDT_SELECT_COUNT;
+			}
+			else
+			{
+				if ( s->fill != s->inside )
+					return HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+
+				vertex_t* v = w->collect + s->collect;
+				__KDT_external_sort_keys(v, s->fill, axis);
+				top->median[base + j] = v[s->rank - s->below];
+				s->mode = KDT_SELECT_DONE;
+			}
+		}
+
+		// Só os nós que acabaram de amostrar contam na próxima passada
+		if ( sampled > 0 )
+			p ^= 1;
+	}
+}
+
+// Medianas exatas dos níveis do topo de uma faixa, nível a nível. A amostra da faixa
+// dá os divisores iniciais de todos os níveis
+static status_t __KDT_external_select(kd_external_t* ex, const kd_extent_t* ext, kd_top_t* top)
+{
+	const uint32_t nodes = 1u << top->levels;
+
+	kd_select_work_t w;
+	memset(&w, 0, sizeof(w));
+	w.num_sample = ex->cap/8;
+	w.split_cap = ex->cap/8;
+	w.collect_cap = ex->cap/2;
+
+	status_t status = HXT_STATUS_OK;
+	if ( HXT_malloc(&w.sample, w.num_sample*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.split[0], w.split_cap*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.split[1], w.split_cap*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.count, (w.split_cap + nodes)*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.collect, w.collect_cap*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.chunk, KDT_EXTERNAL_CHUNK*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.node, (KDT_EXTERNAL_CHUNK > w.num_sample ? KDT_EXTERNAL_CHUNK : w.num_sample)*sizeof(uint32_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.bucket, KDT_EXTERNAL_CHUNK*sizeof(uint32_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&w.sel, nodes/2*sizeof(kd_select_t)) != HXT_STATUS_OK )
+		status = HXT_STATUS_OUT_OF_MEMORY;
+
+	if ( status == HXT_STATUS_OK )
+		status = __KDT_external_sample(ex, ext, w.sample, &w.num_sample);
+
+	for (int l = 0; l < top->levels && status == HXT_STATUS_OK; l++)
+	{
+		status = __KDT_external_select_level(ex, ext, top, l, &w);
+
+		// Células dos filhos: cortadas na mediana, como na construção em memória
+		for (uint32_t c = 1u << l; c < (2u << l) && status == HXT_STATUS_OK; c++)
+		{
+			const int axis = top->axis[c];
+			top->box[2*c] = top->box[c];
+			top->box[2*c + 1] = top->box[c];
+			top->box[2*c].max[axis] = top->median[c].coord[axis];
+			top->box[2*c + 1].min[axis] = top->median[c].coord[axis];
+
+			for (uint32_t k = 2*c; k <= 2*c + 1; k++) {
+				const double dx = top->box[k].max[0] - top->box[k].min[0];
+				const double dy = top->box[k].max[1] - top->box[k].min[1];
+				const double dz = top->box[k].max[2] - top->box[k].min[2];
+				top->axis[k] = MAX3_IDX(dx, dy, dz);
+			}
+		}
+	}
+
+	HXT_free(&w.sel);
+	HXT_free(&w.bucket);
+	HXT_free(&w.node);
+	HXT_free(&w.chunk);
+	HXT_free(&w.collect);
+	HXT_free(&w.count);
+	HXT_free(&w.split[1]);
+	HXT_free(&w.split[0]);
+	HXT_free(&w.sample);
+	return status;
+}
+
+// Esvazia o buffer de escrita de uma célula na sua região do arquivo temporário
+static status_t __KDT_external_flush(FILE* tmp, const vertex_t* buffer, const uint64_t first,
+                                     uint64_t* written, uint64_t* fill)
+{
+	if ( *fill == 0 )
+		return HXT_STATUS_OK;
+
+	if ( fseeko(tmp, (off_t) ((first + *written)*sizeof(vertex_t)), SEEK_SET) != 0
+	  || fwrite(buffer, sizeof(vertex_t), *fill, tmp) != *fill )
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing a temporary file");
+
+	*written += *fill;
+	*fill = 0;
+	return HXT_STATUS_OK;
+}
+
+// Distribui os pontos da faixa, menos as medianas do topo, nas células abaixo dele,
+// num arquivo temporário. Cada célula recebe um buffer de escrita; os buffers somam
+// metade do orçamento. As células vão para o temporário que não contém a faixa, nos
+// mesmos registros que ela ocupa: ali só havia a faixa de quem a distribuiu, já
+// consumida. Assim os dois temporários nunca passam de n registros.
+static status_t __KDT_external_distribute(const kd_external_t* ex, const kd_extent_t* ext, const kd_top_t* top,
+                                          FILE* tmp, uint64_t* first)
+{
+	const uint32_t cells = 1u << top->levels;
+	const uint64_t* size = top->n + cells;
+
+	uint64_t per_cell = ex->budget/2/cells/sizeof(vertex_t);
+	if ( per_cell == 0 )
+		per_cell = 1;
+
+	uint64_t* fill = NULL;
+	uint64_t* written = NULL;
+	vertex_t* chunk = NULL;
+	uint32_t* cls = NULL;
+	vertex_t* buffers = NULL;
+
+	status_t status = HXT_STATUS_OK;
+	if ( HXT_malloc(&fill, cells*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&written, cells*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&chunk, KDT_EXTERNAL_CHUNK*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&cls, KDT_EXTERNAL_CHUNK*sizeof(uint32_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&buffers, cells*per_cell*sizeof(vertex_t)) != HXT_STATUS_OK )
+		status = HXT_STATUS_OUT_OF_MEMORY;
+
+	if ( status == HXT_STATUS_OK )
+	{
+		uint64_t offset = ext->first;
+		for (uint32_t c = 0; c < cells; c++) {
+			first[c] = offset;
+			offset += size[c];
+			fill[c] = 0;
+			written[c] = 0;
+		}
+	}
+
+	for (uint64_t i = 0; i < ext->n && status == HXT_STATUS_OK; i += KDT_EXTERNAL_CHUNK)
+	{
+		const uint64_t m = ext->n - i < KDT_EXTERNAL_CHUNK ? ext->n - i : KDT_EXTERNAL_CHUNK;
+		status = __KDT_external_read(ex, ext, i, m, chunk);
+		if ( status != HXT_STATUS_OK )
+			break;
+
+		#pragma omp parallel for num_threads(ex->num_threads) if(m > 4096)
+		for (uint64_t j = 0; j < m; j++)
+			cls[j] = __KDT_external_node(top, top->levels, &chunk[j]);
+
+		for (uint64_t j = 0; j < m && status == HXT_STATUS_OK; j++)
+		{
+			if ( cls[j] == 0 )
+				continue;
+
+			const uint32_t c = cls[j] - cells;
+			if ( written[c] + fill[c] == size[c] ) {
+				status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+				break;
+			}
+			buffers[c*per_cell + fill[c]++] = chunk[j];
+			if ( fill[c] == per_cell )
+				status = __KDT_external_flush(tmp, buffers + c*per_cell, first[c], &written[c], &fill[c]);
+		}
+	}
+
+	for (uint32_t c = 0; c < cells && status == HXT_STATUS_OK; c++)
+		status = __KDT_external_flush(tmp, buffers + c*per_cell, first[c], &written[c], &fill[c]);
+
+	for (uint32_t c = 0; c < cells && status == HXT_STATUS_OK; c++)
+		if ( written[c] != size[c] )
+			status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "the input file changed during the sort");
+
+	HXT_free(&buffers);
+	HXT_free(&cls);
+	HXT_free(&chunk);
+	HXT_free(&written);
+	HXT_free(&fill);
+	return status;
+}
+
+static status_t __KDT_external_process(kd_external_t* ex, const kd_extent_t* ext, const bbox_t box, uint32_t* id);
+
+// Faixa grande demais para a memória: escolhe as medianas exatas dos níveis do topo,
+// até os nós caberem na memória, distribui o resto em células e processa cada célula
+static status_t __KDT_external_split(kd_external_t* ex, const kd_extent_t* ext, const bbox_t box, uint32_t* id)
+{
+	kd_top_t top;
+	top.levels = 1;
+	while ( top.levels < KDT_EXTERNAL_MAX_LEVELS && (ext->n >> top.levels) > ex->cap )
+		top.levels++;
+	const uint32_t cells = 1u << top.levels;
+
+	top.n = NULL;
+	top.box = NULL;
+	top.axis = NULL;
+	top.median = NULL;
+	uint64_t* first = NULL;
+	uint32_t* ids = NULL;
+	FILE* tmp = ext->file == ex->scratch[0] ? ex->scratch[1] : ex->scratch[0];
+
+	status_t status = HXT_STATUS_OK;
+	if ( HXT_malloc(&top.n, 2*cells*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&top.box, 2*cells*sizeof(bbox_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&top.axis, 2*cells*sizeof(int)) != HXT_STATUS_OK
+	  || HXT_malloc(&top.median, cells*sizeof(vertex_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&first, cells*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&ids, cells*sizeof(uint32_t)) != HXT_STATUS_OK )
+		status = HXT_STATUS_OUT_OF_MEMORY;
+
+	if ( status == HXT_STATUS_OK )
+	{
+		// Os tamanhos dos nós são os da árvore implícita: a mediana em (n-1)/2
+		top.n[1] = ext->n;
+		for (uint32_t c = 1; c < cells; c++) {
+			top.n[2*c] = (top.n[c] - 1)/2;
+			top.n[2*c + 1] = top.n[c]/2;
+		}
+
+		const double dx = box.max[0] - box.min[0];
+		const double dy = box.max[1] - box.min[1];
+		const double dz = box.max[2] - box.min[2];
+		top.box[1] = box;
+		top.axis[1] = MAX3_IDX(dx, dy, dz);
+
+		status = __KDT_external_select(ex, ext, &top);
+	}
+
+	if ( status == HXT_STATUS_OK )
+		status = __KDT_external_distribute(ex, ext, &top, tmp, first);
+
+	// Nós do topo na árvore global
+	if ( status == HXT_STATUS_OK )
+	{
+		for (uint32_t c = 1; c < cells; c++) {
+			ids[c] = ex->num_nodes++;
+			kd_ext_node_t* node = &ex->nodes[ids[c]];
+			node->median = top.median[c];
+			node->file = NULL;
+			node->first = 0;
+			node->n = 1;
+		}
+		for (uint32_t c = 1; c < cells/2; c++) {
+			ex->nodes[ids[c]].child[0] = ids[2*c];
+			ex->nodes[ids[c]].child[1] = ids[2*c + 1];
+		}
+		*id = ids[1];
+	}
+
+	for (uint32_t c = 0; c < cells && status == HXT_STATUS_OK; c++)
+	{
+		kd_extent_t cell = { tmp, 0, first[c], top.n[cells + c] };
+		uint32_t child;
+		status = __KDT_external_process(ex, &cell, top.box[cells + c], &child);
+		if ( status == HXT_STATUS_OK )
+			ex->nodes[ids[(cells + c)/2]].child[c & 1] = child;
+	}
+
+	HXT_free(&ids);
+	HXT_free(&first);
+	HXT_free(&top.median);
+	HXT_free(&top.axis);
+	HXT_free(&top.box);
+	HXT_free(&top.n);
+	return status;
+}
+
+static status_t __KDT_external_process(kd_external_t* ex, const kd_extent_t* ext, const bbox_t box, uint32_t* id)
+{
+	if ( ext->n > ex->cap )
+		return __KDT_external_split(ex, ext, box, id);
+
+	*id = ex->num_nodes++;
+	kd_ext_node_t* node = &ex->nodes[*id];
+	node->child[0] = KDT_EXTERNAL_CELL;
+	node->child[1] = KDT_EXTERNAL_CELL;
+	node->file = ext->file;
+	node->first = ext->first;
+	node->n = ext->n;
+	return __KDT_external_sort_cell(ex, ext, box);
+}
+
+// Entrada da fila de um nível da ordem global: um nó acima das células, ou o nível
+// level da ordem em largura de uma célula, que começa offset pontos na célula
+typedef struct {
+	uint32_t node;
+	int level;
+	uint64_t offset;
+} kd_ext_queue_t;
+
+// Escreve a ordem global nível a nível. Em cada nível, da esquerda para a direita,
+// saem as medianas dos nós acima das células e o nível correspondente da ordem em
+// largura de cada célula, lido do temporário em que ela foi guardada
+static status_t __KDT_external_merge(const kd_external_t* ex, const uint32_t root)
+{
+	kd_ext_queue_t* queue = NULL;
+	kd_ext_queue_t* next = NULL;
+	vertex_t* chunk = NULL;
+
+	status_t status = HXT_STATUS_OK;
+	if ( HXT_malloc(&queue, ex->num_nodes*sizeof(kd_ext_queue_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&next, ex->num_nodes*sizeof(kd_ext_queue_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&chunk, KDT_EXTERNAL_CHUNK*sizeof(vertex_t)) != HXT_STATUS_OK )
+		status = HXT_STATUS_OUT_OF_MEMORY;
+
+	uint32_t num = 1;
+	if ( status == HXT_STATUS_OK ) {
+		queue[0].node = root;
+		queue[0].level = 0;
+		queue[0].offset = 0;
+	}
+
+	while ( num > 0 && status == HXT_STATUS_OK )
+	{
+		uint32_t num_next = 0;
+		for (uint32_t i = 0; i < num && status == HXT_STATUS_OK; i++)
+		{
+			const kd_ext_node_t* node = &ex->nodes[queue[i].node];
+			if ( node->child[0] != KDT_EXTERNAL_CELL )
+			{
+				chunk[0] = node->median;
+				status = __KDT_external_write(ex, chunk, 1);
+
+				for (int k = 0; k < 2; k++) {
+					next[num_next].node = node->child[k];
+					next[num_next].level = 0;
+					next[num_next].offset = 0;
+					num_next++;
+				}
+				continue;
+			}
+
+			const uint64_t size = __KDT_external_level_size(node->n, queue[i].level);
+			if ( size == 0 )
+				continue;
+
+			const kd_extent_t cell = { node->file, 0, node->first + queue[i].offset, size };
+			for (uint64_t j = 0; j < size && status == HXT_STATUS_OK; j += KDT_EXTERNAL_CHUNK)
+			{
+				const uint64_t m = size - j < KDT_EXTERNAL_CHUNK ? size - j : KDT_EXTERNAL_CHUNK;
+				status = __KDT_external_read(ex, &cell, j, m, chunk);
+				if ( status == HXT_STATUS_OK )
+					status = __KDT_external_write(ex, chunk, m);
+			}
+
+			next[num_next].node = queue[i].node;
+			next[num_next].level = queue[i].level + 1;
+			next[num_next].offset = queue[i].offset + size;
+			num_next++;
+		}
+
+		kd_ext_queue_t* swap = queue;
+		queue = next;
+		next = swap;
+		num = num_next;
+	}
+
+	HXT_free(&chunk);
+	HXT_free(&next);
+	HXT_free(&queue);
+	return status;
+}
+
+status_t KDT_external_sort(const char* input, const char* output, const char* index_output,
+                           const kd_external_options_t* options)
+{
+	kd_external_options_t opt;
+	if ( options != NULL )
+		opt = *options;
+	else
+		KDT_external_options_init(&opt);
+
+	kd_external_t ex;
+	memset(&ex, 0, sizeof(ex));
+	ex.budget = opt.memory_budget > KDT_EXTERNAL_MIN_BUDGET ? opt.memory_budget : KDT_EXTERNAL_MIN_BUDGET;
+	ex.cap = ex.budget/KDT_EXTERNAL_BYTES_PER_POINT;
+	if ( ex.cap > UINT32_MAX )
+		ex.cap = UINT32_MAX;
+	ex.num_threads = opt.kd_options.num_threads;
+	#ifdef _OPENMP
+	if ( ex.num_threads <= 0 )
+		ex.num_threads = omp_get_max_threads();
+	#else
+	ex.num_threads = 1;
+	#endif
+
+	// As células saem na ordem em largura pura, a única que se junta nível a nível
+	ex.kd = opt.kd_options;
+	ex.kd.brio_ratio = 0.0;
+	ex.kd.bfs_levels = -1;
+	ex.kd.bucket_size = 0;
+	ex.kd.level_curve = KDT_CURVE_NONE;
+	ex.kd.split_policy = KDT_SPLIT_LONGEST_EDGE;
+	KDT_random_seed(&ex.rng, opt.kd_options.seed);
+
+	FILE* in;
+	kd_point_file_t points;
+	HXT_CHECK( KDT_io_open(input, &in, &points) );
+	if ( points.stride != 3*sizeof(double) && points.stride != sizeof(vertex_t) ) {
+		fclose(in);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s has an unsupported point stride (%u bytes)", input, points.stride);
+	}
+	ex.input_offset = points.header_size;
+	ex.input_stride = points.stride;
+
+	ex.output = fopen(output, "wb");
+	if ( ex.output != NULL && index_output != NULL )
+		ex.index = fopen(index_output, "wb");
+
+	status_t status = HXT_STATUS_OK;
+	if ( ex.output == NULL || (index_output != NULL && ex.index == NULL) )
+		status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot open the output files");
+	else if ( KDT_io_write_header(ex.output, 3*sizeof(double), points.count, &points.bbox) != HXT_STATUS_OK )
+		status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", output);
+
+	kd_extent_t ext = { in, 1, 0, points.count };
+	if ( status == HXT_STATUS_OK && ext.n <= ex.cap )
+		status = __KDT_external_sort_cell(&ex, &ext, points.bbox);
+	else if ( status == HXT_STATUS_OK )
+	{
+		// A árvore global desce até os nós caberem na memória: no máximo 2^(d+1) nós
+		int depth = 0;
+		while ( (ext.n >> depth) > ex.cap )
+			depth++;
+
+		ex.scratch[0] = tmpfile();
+		ex.scratch[1] = tmpfile();
+		if ( ex.scratch[0] == NULL || ex.scratch[1] == NULL )
+			status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot create a temporary file");
+		else
+			status = HXT_malloc(&ex.nodes, ((size_t) 2 << depth)*sizeof(kd_ext_node_t));
+
+		uint32_t root = 0;
+		if ( status == HXT_STATUS_OK )
+			status = __KDT_external_process(&ex, &ext, points.bbox, &root);
+		if ( status == HXT_STATUS_OK )
+			status = __KDT_external_merge(&ex, root);
+	}
+
+	HXT_free(&ex.nodes);
+	if ( ex.scratch[1] != NULL )
+		fclose(ex.scratch[1]);
+	if ( ex.scratch[0] != NULL )
+		fclose(ex.scratch[0]);
+
+	if ( ex.index != NULL && fclose(ex.index) != 0 && status == HXT_STATUS_OK )
+		status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", index_output);
+	if ( ex.output != NULL && fclose(ex.output) != 0 && status == HXT_STATUS_OK )
+		status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", output);
+	fclose(in);
+
+	return status;
+}
@@ -0,0 +1,579 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+// Arquivos maiores que 2 GiB também em sistemas de 32 bits
+#define _FILE_OFFSET_BITS 64
+
+#include <float.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <kdt_io.h>
+
+#define KDT_IO_MAGIC "KDTPNTS"
+#define KDT_IO_ENDIAN 0x01020304u
+
+// Pontos acumulados antes de cada escrita
+#define KDT_IO_CHUNK 65536
+
+// Cabeçalho do arquivo; ocupa os primeiros KDT_IO_HEADER_SIZE bytes (o resto é zero)
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t header_size;
+	uint32_t stride;
+	uint64_t count;
+	double min[3];
+	double max[3];
+} kd_io_header_t;
+
+// Escrita em fluxo: os pontos vão para o buffer e o cabeçalho, com a contagem e a
+// bbox, é escrito por último
+typedef struct {
+	FILE* file;
+	const char* filename;
+	uint32_t stride;
+	uint64_t count;
+	bbox_t bbox;
+	double* buffer;
+	size_t filled;			// Doubles no buffer
+} kd_io_writer_t;
+
+status_t KDT_io_write_header(FILE* file, uint32_t stride, uint64_t count, const bbox_t* bbox)
+{
+	kd_io_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KDT_IO_MAGIC, sizeof(KDT_IO_MAGIC));
+	header.version = KDT_IO_VERSION;
+	header.endian = KDT_IO_ENDIAN;
+	header.header_size = KDT_IO_HEADER_SIZE;
+	header.stride = stride;
+	header.count = count;
+	for (int i = 0; i < 3; i++) {
+		header.min[i] = count > 0 ? bbox->min[i] : 0.0;
+		header.max[i] = count > 0 ? bbox->max[i] : 0.0;
+	}
+
+	// O resto do cabeçalho é zero
+	char pad[KDT_IO_HEADER_SIZE - sizeof(kd_io_header_t)] = {0};
+	if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(pad, 1, sizeof(pad), file) != sizeof(pad))
+		return HXT_STATUS_FAILED;
+	return HXT_STATUS_OK;
+}
+
+// Confere o cabeçalho de um arquivo de size bytes; devolve o erro, ou NULL
+static const char* __KDT_io_check_header(const kd_io_header_t* header, uint64_t size)
+{
+	if (memcmp(header->magic, KDT_IO_MAGIC, sizeof(KDT_IO_MAGIC)) != 0)
+		return "is not a point file";
+	if (header->endian != KDT_IO_ENDIAN)
+		return "has a different byte order";
+	if (header->version > KDT_IO_VERSION)
+		return "has an unsupported version";
+	if (header->header_size < sizeof(kd_io_header_t) || header->header_size % sizeof(double) != 0 ||
+	    header->stride < 3*sizeof(double) || header->stride % sizeof(double) != 0 ||
+	    header->header_size > size || header->count > (size - header->header_size)/header->stride)
+		return "is truncated or corrupt";
+	return NULL;
+}
+
+static void __KDT_io_describe(const kd_io_header_t* header, kd_point_file_t* points)
+{
+	points->count = header->count;
+	points->stride = header->stride;
+	points->header_size = header->header_size;
+	for (int i = 0; i < 3; i++) {
+		points->bbox.min[i] = header->min[i];
+		points->bbox.max[i] = header->max[i];
+	}
+}
+
+static status_t __KDT_io_begin(kd_io_writer_t* w, const char* filename, uint32_t stride)
+{
+	if (stride != 3*sizeof(double) && stride != sizeof(vertex_t))
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "invalid point stride %u", stride);
+
+	w->filename = filename;
+	w->stride = stride;
+	w->count = 0;
+	w->filled = 0;
+	for (int i = 0; i < 3; i++) {
+		w->bbox.min[i] = DBL_MAX;
+		w->bbox.max[i] = -DBL_MAX;
+	}
+
+	HXT_CHECK( HXT_malloc(&w->buffer, (size_t) KDT_IO_CHUNK*stride) );
+
+	w->file = fopen(filename, "wb");
+	if (w->file == NULL) {
+		HXT_free(&w->buffer);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", filename);
+	}
+
+	// Espaço do cabeçalho, preenchido em __KDT_io_finish
+	char header[KDT_IO_HEADER_SIZE] = {0};
+	if (fwrite(header, 1, KDT_IO_HEADER_SIZE, w->file) != KDT_IO_HEADER_SIZE) {
+		fclose(w->file);
+		HXT_free(&w->buffer);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", filename);
+	}
+	return HXT_STATUS_OK;
+}
+
+// Fecha e apaga um arquivo incompleto
+static void __KDT_io_abort(kd_io_writer_t* w)
+{
+	fclose(w->file);
+	remove(w->filename);
+	HXT_free(&w->buffer);
+}
+
+static status_t __KDT_io_flush(kd_io_writer_t* w)
+{
+	if (w->filled > 0 && fwrite(w->buffer, sizeof(double), w->filled, w->file) != w->filled)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", w->filename);
+	w->filled = 0;
+	return HXT_STATUS_OK;
+}
+
+static status_t __KDT_io_put(kd_io_writer_t* w, const double* p)
+{
+	double* r = w->buffer + w->filled;
+	for (int i = 0; i < 3; i++) {
+		r[i] = p[i];
+		if (p[i] < w->bbox.min[i])
+			w->bbox.min[i] = p[i];
+		if (p[i] > w->bbox.max[i])
+			w->bbox.max[i] = p[i];
+	}
+
+	// O índice original fica no campo dist do vertex_t
+	if (w->stride == sizeof(vertex_t)) {
+		uint64_t index = w->count;
+		memcpy(r + 3, &index, sizeof(uint64_t));
+	}
+
+	w->filled += w->stride/sizeof(double);
+	w->count++;
+	if (w->filled == (size_t) KDT_IO_CHUNK*w->stride/sizeof(double))
+		HXT_CHECK( __KDT_io_flush(w) );
+	return HXT_STATUS_OK;
+}
+
+static status_t __KDT_io_finish(kd_io_writer_t* w)
+{
+	status_t status = __KDT_io_flush(w);
+	if (status != HXT_STATUS_OK) {
+		__KDT_io_abort(w);
+		return status;
+	}
+
+	if (fseeko(w->file, 0, SEEK_SET) != 0 || KDT_io_write_header(w->file, w->stride, w->count, &w->bbox) != HXT_STATUS_OK) {
+		__KDT_io_abort(w);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", w->filename);
+	}
+
+	HXT_free(&w->buffer);
+	if (fclose(w->file) != 0)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", w->filename);
+	return HXT_STATUS_OK;
+}
+
+status_t KDT_io_write(const char* filename, const double* coord, size_t stride, uint64_t n, uint32_t file_stride)
+{
+	kd_io_writer_t w;
+	HXT_CHECK( __KDT_io_begin(&w, filename, file_stride) );
+
+	for (uint64_t i = 0; i < n; i++) {
+		status_t status = __KDT_io_put(&w, (const double*) ((const char*) coord + i*stride));
+		if (status != HXT_STATUS_OK) {
+			__KDT_io_abort(&w);
+			return status;
+		}
+	}
+
+	return __KDT_io_finish(&w);
+}
+
+// Potências de 10 exatas em double
+static const double __KDT_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int __KDT_is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* __KDT_skip_blanks(const char* p, const char* end)
+{
+	while (p < end && __KDT_is_blank(*p))
+		p++;
+	return p;
+}
+
+static inline const char* __KDT_next_line(const char* p, const char* end)
+{
+	const char* nl = memchr(p, '\n', end - p);
+	return nl != NULL ? nl + 1 : end;
+}
+
+// Linha sem dados: vazia ou comentário
+static inline int __KDT_is_data_line(const char* p, const char* end)
+{
+	p = __KDT_skip_blanks(p, end);
+	return p < end && *p != '\n' && *p != '#';
+}
+
+// Lê um double de [p, end). Com até 19 dígitos significativos e expoente decimal
+// de no máximo 22, mantissa e potência são exatas e o produto é o arredondamento
+// correto; fora disso, strtod resolve. Devolve o fim do número ou NULL.
+static const char* __KDT_parse_double(const char* p, const char* end, double* value)
+{
+	const char* start = p;
+	int negative = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0, any = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+		if (digits < 19) {
+			mantissa = 10*mantissa + (uint64_t) (*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = 1) {
+			if (digits < 19) {
+				mantissa = 10*mantissa + (uint64_t) (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+		goto slow;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		int exp_negative = 0, exp = 0;
+		if (q < end && (*q == '-' || *q == '+'))
+			exp_negative = *q++ == '-';
+		if (q == end || *q < '0' || *q > '9')
+			goto slow;
+		for (; q < end && *q >= '0' && *q <= '9'; q++)
+			if (exp < 100000)
+				exp = 10*exp + (*q - '0');
+		exponent += exp_negative ? -exp : exp;
+		p = q;
+	}
+
+	if (p < end && !__KDT_is_blank(*p) && *p != '\n')
+		goto slow;
+	if (mantissa >> 53 != 0 || exponent < -22 || exponent > 22)
+		goto slow;
+
+	double v = (double) mantissa;
+	v = exponent < 0 ? v / __KDT_pow10[-exponent] : v * __KDT_pow10[exponent];
+	*value = negative ? -v : v;
+	return p;
+
+slow:;
+	// Casos raros (muitos dígitos, expoentes grandes, inf, nan): strtod numa cópia
+	// terminada em zero, já que o mapeamento não é
+	char buffer[128];
+	size_t len = 0;
+	while (start + len < end && len < sizeof(buffer) - 1 &&
+	       !__KDT_is_blank(start[len]) && start[len] != '\n')
+		len++;
+	memcpy(buffer, start, len);
+	buffer[len] = '\0';
+	char* stop;
+	*value = strtod(buffer, &stop);
+	if (len == 0 || stop != buffer + len)
+		return NULL;
+	return start + len;
+}
+
+// Pula um campo (o índice do ponto, atributos)
+static inline const char* __KDT_skip_field(const char* p, const char* end)
+{
+	const char* q = p;
+	while (q < end && !__KDT_is_blank(*q) && *q != '\n')
+		q++;
+	return q > p ? q : NULL;
+}
+
+static const char* __KDT_parse_unsigned(const char* p, const char* end, unsigned long* value)
+{
+	const char* q = p;
+	*value = 0;
+	for (; q < end && *q >= '0' && *q <= '9'; q++)
+		*value = 10*(*value) + (unsigned long) (*q - '0');
+	return q > p ? q : NULL;
+}
+
+status_t KDT_io_read_node(const char* filename, vertex_t** vertices_p, uint32_t* n, bbox_t* bbox, int num_threads)
+{
+#ifdef _OPENMP
+	if (num_threads <= 0)
+		num_threads = omp_get_max_threads();
+#else
+	num_threads = 1;
+#endif
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", filename);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading 1st line of %s", filename);
+	}
+
+	size_t size = (size_t) st.st_size;
+	const char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot map %s", filename);
+	madvise((void*) text, size, MADV_SEQUENTIAL);
+	const char* end = text + size;
+
+	// Primeira linha com dados: pontos e dimensão (atributos e marcadores ficam no
+	// resto de cada linha, que é ignorado)
+	const char* p = text;
+	while (p < end && !__KDT_is_data_line(p, end))
+		p = __KDT_next_line(p, end);
+	unsigned long npts, dim;
+	const char* q = __KDT_parse_unsigned(__KDT_skip_blanks(p, end), end, &npts);
+	if (q != NULL)
+		q = __KDT_parse_unsigned(__KDT_skip_blanks(q, end), end, &dim);
+	if (q == NULL || dim != 3 || npts > UINT32_MAX) {
+		munmap((void*) text, size);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading 1st line of %s", filename);
+	}
+	const char* body = __KDT_next_line(q, end);
+
+	status_t status = HXT_malloc(vertices_p, sizeof(vertex_t)*npts);
+	if (status != HXT_STATUS_OK) {
+		munmap((void*) text, size);
+		return status;
+	}
+	vertex_t* vertices = *vertices_p;
+
+	// Pedaços alinhados às linhas: cada um começa depois de uma quebra de linha
+	int nchunks = (size_t) (end - body) < ((size_t) 1 << 20) ? 1 : 4*num_threads;
+	const char** bounds = NULL;
+	uint64_t* first = NULL;
+	bbox_t* partial = NULL;
+	status = HXT_malloc(&bounds, sizeof(const char*)*(nchunks + 1));
+	if (status == HXT_STATUS_OK)
+		status = HXT_malloc(&first, sizeof(uint64_t)*(nchunks + 1));
+	if (status == HXT_STATUS_OK)
+		status = HXT_malloc(&partial, sizeof(bbox_t)*nchunks);
+	if (status != HXT_STATUS_OK) {
+		HXT_free(&bounds);
+		HXT_free(&first);
+		HXT_free(&partial);
+		munmap((void*) text, size);
+		HXT_free(vertices_p);
+		return status;
+	}
+	bounds[0] = body;
+	for (int c = 1; c < nchunks; c++) {
+		const char* b = body + (size_t) (end - body)*c/nchunks;
+		bounds[c] = b > bounds[c-1] ? __KDT_next_line(b - 1, end) : bounds[c-1];
+	}
+	bounds[nchunks] = end;
+
+	// Primeira passada: linhas com dados de cada pedaço, para saber onde cada um escreve
+	#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int c = 0; c < nchunks; c++) {
+		uint64_t count = 0;
+		for (const char* l = bounds[c]; l < bounds[c+1]; l = __KDT_next_line(l, bounds[c+1]))
+			count += __KDT_is_data_line(l, bounds[c+1]);
+		first[c+1] = count;
+	}
+	first[0] = 0;
+	for (int c = 0; c < nchunks; c++)
+		first[c+1] += first[c];
+
+	if (first[nchunks] < npts) {
+		status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s has %lu points instead of %lu", filename,
+		                       (unsigned long) first[nchunks], npts);
+	}
+	else {
+		// Segunda passada: índice, x, y, z; o resto da linha é ignorado. Linhas além
+		// de npts (comentários sem '#', por exemplo) não são lidas
+		int error = 0;
+		#pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(|:error)
+		for (int c = 0; c < nchunks; c++) {
+			bbox_t b = {{DBL_MAX, DBL_MAX, DBL_MAX}, {-DBL_MAX, -DBL_MAX, -DBL_MAX}};
+			uint64_t i = first[c];
+			for (const char* l = bounds[c]; l < bounds[c+1] && i < npts && !error; l = __KDT_next_line(l, bounds[c+1])) {
+				if (!__KDT_is_data_line(l, bounds[c+1]))
+					continue;
+				const char* r = __KDT_skip_field(__KDT_skip_blanks(l, bounds[c+1]), bounds[c+1]);
+				for (int j = 0; j < 3 && r != NULL; j++) {
+					r = __KDT_parse_double(__KDT_skip_blanks(r, bounds[c+1]), bounds[c+1], &vertices[i].coord[j]);
+					if (r != NULL) {
+						if (vertices[i].coord[j] < b.min[j])
+							b.min[j] = vertices[i].coord[j];
+						if (vertices[i].coord[j] > b.max[j])
+							b.max[j] = vertices[i].coord[j];
+					}
+				}
+				if (r == NULL)
+					error = 1;
+				vertices[i].dist = i;
+				i++;
+			}
+			partial[c] = b;
+		}
+
+		if (error) {
+			status = HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading %s", filename);
+		}
+		else {
+			// Redução das bboxes parciais
+			bbox_t b = {{DBL_MAX, DBL_MAX, DBL_MAX}, {-DBL_MAX, -DBL_MAX, -DBL_MAX}};
+			for (int c = 0; c < nchunks; c++) {
+				for (int j = 0; j < 3; j++) {
+					if (partial[c].min[j] < b.min[j])
+						b.min[j] = partial[c].min[j];
+					if (partial[c].max[j] > b.max[j])
+						b.max[j] = partial[c].max[j];
+				}
+			}
+			*bbox = b;
+			*n = npts;
+		}
+	}
+
+	HXT_free(&bounds);
+	HXT_free(&first);
+	HXT_free(&partial);
+	munmap((void*) text, size);
+	if (status != HXT_STATUS_OK)
+		HXT_free(vertices_p);
+	return status;
+}
+
+status_t KDT_io_convert_node(const char* node_file, const char* filename, uint32_t file_stride)
+{
+	vertex_t* vertices;
+	uint32_t n;
+	bbox_t bbox;
+	HXT_CHECK( KDT_io_read_node(node_file, &vertices, &n, &bbox, 0) );
+
+	status_t status = KDT_io_write(filename, vertices[0].coord, sizeof(vertex_t), n, file_stride);
+	HXT_free(&vertices);
+	return status;
+}
+
+status_t KDT_io_map(const char* filename, kd_point_file_t* points)
+{
+	memset(points, 0, sizeof(kd_point_file_t));
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", filename);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < KDT_IO_HEADER_SIZE) {
+		close(fd);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s is not a point file", filename);
+	}
+
+	// Mapeamento privado: as escritas (a ordenação) ficam na memória, não no arquivo
+	size_t size = (size_t) st.st_size;
+	void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot map %s", filename);
+
+	kd_io_header_t header;
+	memcpy(&header, map, sizeof(header));
+
+	const char* error = __KDT_io_check_header(&header, size);
+	if (error != NULL) {
+		munmap(map, size);
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s %s", filename, error);
+	}
+
+	// A ordenação percorre o array todo: vale ler o arquivo adiantado
+	madvise(map, size, MADV_WILLNEED);
+
+	__KDT_io_describe(&header, points);
+	points->map = map;
+	points->map_size = size;
+	points->coord = (const double*) ((char*) map + header.header_size);
+	if (header.stride == sizeof(vertex_t))
+		points->vertices = (vertex_t*) ((char*) map + header.header_size);
+	return HXT_STATUS_OK;
+}
+
+status_t KDT_io_open(const char* filename, FILE** file, kd_point_file_t* points)
+{
+	memset(points, 0, sizeof(kd_point_file_t));
+
+	*file = fopen(filename, "rb");
+	if (*file == NULL)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", filename);
+
+	kd_io_header_t header;
+	off_t size = -1;
+	const char* error = "is not a point file";
+	if (fread(&header, sizeof(header), 1, *file) == 1 && fseeko(*file, 0, SEEK_END) == 0)
+		size = ftello(*file);
+	if (size >= 0)
+		error = __KDT_io_check_header(&header, (uint64_t) size);
+
+	if (error != NULL) {
+		fclose(*file);
+		*file = NULL;
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s %s", filename, error);
+	}
+
+	__KDT_io_describe(&header, points);
+	return HXT_STATUS_OK;
+}
+
+status_t KDT_io_unmap(kd_point_file_t* points)
+{
+	if (points->map != NULL && munmap(points->map, points->map_size) != 0)
+		return HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot unmap the point file");
+	memset(points, 0, sizeof(kd_point_file_t));
+	return HXT_STATUS_OK;
+}
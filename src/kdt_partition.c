@@ -0,0 +1,426 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#include <kdt_simd.h>
+#include <kdt_partition.h>
+
+// Tamanho dos blocos da partição sem desvios
+#define KDT_PARTITION_BLOCK 128
+
+// Extensão usada por uma versão dos laços genéricos (constante em cada versão)
+#define KDT_ISA_SCALAR 0
+#define KDT_ISA_AVX2 1
+#define KDT_ISA_AVX512 2
+
+// Os núcleos abaixo guardam em offsets as posições das chaves de um bloco de
+// KDT_PARTITION_BLOCK pontos que são maiores que o pivô (greater = 1) ou menores ou
+// iguais a ele (greater = 0) e retornam quantas são. Nenhum desvio depende das
+// chaves: as comparações viram máscaras e a posição é sempre escrita, avançando o
+// contador só quando o ponto é selecionado. As posições saem em ordem crescente em
+// todas as versões, logo as trocas, e o arranjo final, são os mesmos em qualquer CPU.
+
+static inline uint32_t __KDT_block_offsets_scalar(const vertex_t* v, const int axis, const double pivot,
+                                                  const int greater, uint32_t* offsets)
+{
+	uint32_t num = 0;
+	for (uint32_t i = 0; i < KDT_PARTITION_BLOCK; i++)
+	{
+		offsets[num] = i;
+		num += greater ? (v[i].coord[axis] > pivot) : (v[i].coord[axis] <= pivot);
+	}
+	return num;
+}
+
+static inline uint32_t __KDT_key_offsets_scalar(const double* key, const double pivot, const int greater,
+                                                uint32_t* offsets)
+{
+	uint32_t num = 0;
+	for (uint32_t i = 0; i < KDT_PARTITION_BLOCK; i++)
+	{
+		offsets[num] = i;
+		num += greater ? (key[i] > pivot) : (key[i] <= pivot);
+	}
+	return num;
+}
+
+#ifdef KDT_X86_SIMD
+// Posições dos bits ligados de cada máscara de 4 bits
+static const int32_t __KDT_mask_positions[16][4] = {
+	{0,0,0,0}, {0,0,0,0}, {1,0,0,0}, {0,1,0,0},
+	{2,0,0,0}, {0,2,0,0}, {1,2,0,0}, {0,1,2,0},
+	{3,0,0,0}, {0,3,0,0}, {1,3,0,0}, {0,1,3,0},
+	{2,3,0,0}, {0,2,3,0}, {1,2,3,0}, {0,1,2,3}
+};
+
+// Registros vertex_t: as chaves são lidas com gather, sem cópia. Só vale a pena com
+// AVX-512 (3,7 contra 4,4 ns por ponto do laço escalar em 4M pontos); o gather do
+// AVX2 ficou mais lento que o laço escalar (5,1 ns) e não é usado.
+KDT_TARGET_AVX512
+static inline uint32_t __KDT_block_offsets_avx512(const vertex_t* v, const int axis, const double pivot,
+                                                  const int greater, uint32_t* offsets)
+{
+	uint32_t num = 0;
+	const long long s = sizeof(vertex_t);
+	const __m512i index = _mm512_set_epi64(7*s, 6*s, 5*s, 4*s, 3*s, 2*s, s, 0);
+	const __m256i iota = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	const __m512d p = _mm512_set1_pd(pivot);
+
+	for (uint32_t i = 0; i < KDT_PARTITION_BLOCK; i += 8)
+	{
+		__m512d key = _mm512_i64gather_pd(index, &v[i].coord[axis], 1);
+		__mmask8 mask = greater ? _mm512_cmp_pd_mask(key, p, _CMP_GT_OQ)
+		                        : _mm512_cmp_pd_mask(key, p, _CMP_LE_OQ);
+		_mm256_mask_compressstoreu_epi32(offsets + num, mask, _mm256_add_epi32(iota, _mm256_set1_epi32(i)));
+		num += __builtin_popcount(mask);
+	}
+	return num;
+}
+
+// Chaves contíguas: leituras normais, sem gather
+KDT_TARGET_AVX512
+static inline uint32_t __KDT_key_offsets_avx512(const double* key, const double pivot, const int greater,
+                                                uint32_t* offsets)
+{
+	uint32_t num = 0;
+	const __m256i iota = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	const __m512d p = _mm512_set1_pd(pivot);
+
+	for (uint32_t i = 0; i < KDT_PARTITION_BLOCK; i += 8)
+	{
+		__m512d k = _mm512_loadu_pd(key + i);
+		__mmask8 mask = greater ? _mm512_cmp_pd_mask(k, p, _CMP_GT_OQ)
+		                        : _mm512_cmp_pd_mask(k, p, _CMP_LE_OQ);
+		_mm256_mask_compressstoreu_epi32(offsets + num, mask, _mm256_add_epi32(iota, _mm256_set1_epi32(i)));
+		num += __builtin_popcount(mask);
+	}
+	return num;
+}
+
+KDT_TARGET_AVX2
+static inline uint32_t __KDT_key_offsets_avx2(const double* key, const double pivot, const int greater,
+                                              uint32_t* offsets)
+{
+	uint32_t num = 0;
+	const __m256d p = _mm256_set1_pd(pivot);
+
+	for (uint32_t i = 0; i < KDT_PARTITION_BLOCK; i += 4)
+	{
+		__m256d k = _mm256_loadu_pd(key + i);
+		int mask = greater ? _mm256_movemask_pd(_mm256_cmp_pd(k, p, _CMP_GT_OQ))
+		                   : _mm256_movemask_pd(_mm256_cmp_pd(k, p, _CMP_LE_OQ));
+		__m128i pos = _mm_loadu_si128((const __m128i*) __KDT_mask_positions[mask]);
+		_mm_storeu_si128((__m128i*) (offsets + num), _mm_add_epi32(pos, _mm_set1_epi32(i)));
+		num += __builtin_popcount(mask);
+	}
+	return num;
+}
+#endif
+
+static KDT_ALWAYS_INLINE uint32_t __KDT_block_offsets(const vertex_t* v, const int axis, const double pivot,
+                                                      const int greater, uint32_t* offsets, const int isa)
+{
+#ifdef KDT_X86_SIMD
+	if ( isa == KDT_ISA_AVX512 )
+		return __KDT_block_offsets_avx512(v, axis, pivot, greater, offsets);
+#endif
+	return __KDT_block_offsets_scalar(v, axis, pivot, greater, offsets);
+}
+
+static KDT_ALWAYS_INLINE uint32_t __KDT_key_offsets(const double* key, const double pivot, const int greater,
+                                                    uint32_t* offsets, const int isa)
+{
+#ifdef KDT_X86_SIMD
+	if ( isa == KDT_ISA_AVX512 )
+		return __KDT_key_offsets_avx512(key, pivot, greater, offsets);
+	if ( isa == KDT_ISA_AVX2 )
+		return __KDT_key_offsets_avx2(key, pivot, greater, offsets);
+#endif
+	return __KDT_key_offsets_scalar(key, pivot, greater, offsets);
+}
+
+// Par (chave, índice) de um array de chaves compactas
+static inline void __KDT_swap_keys(double* key, uint32_t* index, const uint64_t i, const uint64_t j)
+{
+	const double k = key[i];
+	key[i] = key[j];
+	key[j] = k;
+
+	const uint32_t t = index[i];
+	index[i] = index[j];
+	index[j] = t;
+}
+
+// Partição com dois índices, usada nas pontas que não completam dois blocos
+static uint64_t __KDT_partition_le_scalar(vertex_t* v, const uint64_t n, const int axis, const double pivot)
+{
+	uint64_t i = 0;
+	uint64_t j = n;
+
+	while (1)
+	{
+		while ( i < j && v[i].coord[axis] <= pivot )
+			i++;
+		while ( i < j && v[j - 1].coord[axis] > pivot )
+			j--;
+
+		if ( i >= j )
+			return i;
+
+		__swapVertices(&v[i], &v[j - 1]);
+		i++;
+		j--;
+	}
+}
+
+static uint64_t __KDT_keys_partition_le_scalar(double* key, uint32_t* index, const uint64_t n, const double pivot)
+{
+	uint64_t i = 0;
+	uint64_t j = n;
+
+	while (1)
+	{
+		while ( i < j && key[i] <= pivot )
+			i++;
+		while ( i < j && key[j - 1] > pivot )
+			j--;
+
+		if ( i >= j )
+			return i;
+
+		__KDT_swap_keys(key, index, i, j - 1);
+		i++;
+		j--;
+	}
+}
+
+// Partição em blocos (BlockQuicksort, Edelkamp e Weiß). Um bloco na esquerda lista os
+// pontos > pivot, um bloco na direita lista os pontos <= pivot, e os dois são trocados
+// aos pares. A comparação, que erra a previsão em metade dos pontos de uma nuvem
+// aleatória, não controla mais nenhum desvio. Com key != NULL, particiona as chaves
+// compactas (key, index) em vez dos registros v.
+static KDT_ALWAYS_INLINE uint64_t __KDT_block_partition(vertex_t* v, const int axis, double* key, uint32_t* index,
+                                                        const uint64_t n, const double pivot, const int isa)
+{
+	uint32_t left_offsets[KDT_PARTITION_BLOCK + 8];
+	uint32_t right_offsets[KDT_PARTITION_BLOCK + 8];
+	uint32_t left_num = 0, left_start = 0;
+	uint32_t right_num = 0, right_start = 0;
+
+	uint64_t l = 0;
+	uint64_t r = n;
+
+	while ( r - l >= 2*KDT_PARTITION_BLOCK )
+	{
+		if ( left_num == 0 )
+		{
+			left_start = 0;
+			left_num = key != NULL ? __KDT_key_offsets(key + l, pivot, 1, left_offsets, isa)
+			                       : __KDT_block_offsets(v + l, axis, pivot, 1, left_offsets, isa);
+		}
+
+		if ( right_num == 0 )
+		{
+			right_start = 0;
+			right_num = key != NULL ? __KDT_key_offsets(key + r - KDT_PARTITION_BLOCK, pivot, 0, right_offsets, isa)
+			                        : __KDT_block_offsets(v + r - KDT_PARTITION_BLOCK, axis, pivot, 0, right_offsets, isa);
+		}
+
+		uint32_t num = left_num < right_num ? left_num : right_num;
+		for (uint32_t j = 0; j < num; j++)
+		{
+			const uint64_t a = l + left_offsets[left_start + j];
+			const uint64_t b = r - KDT_PARTITION_BLOCK + right_offsets[right_start + j];
+			if ( key != NULL )
+				__KDT_swap_keys(key, index, a, b);
+			else
+				__swapVertices(&v[a], &v[b]);
+		}
+
+		left_num -= num;
+		left_start += num;
+		right_num -= num;
+		right_start += num;
+
+		if ( left_num == 0 )
+			l += KDT_PARTITION_BLOCK;
+		if ( right_num == 0 )
+			r -= KDT_PARTITION_BLOCK;
+	}
+
+	// O que sobra, inclusive um bloco trocado só em parte, é particionado normalmente
+	if ( key != NULL )
+		return l + __KDT_keys_partition_le_scalar(key + l, index + l, r - l, pivot);
+	return l + __KDT_partition_le_scalar(v + l, r - l, axis, pivot);
+}
+
+#ifdef KDT_X86_SIMD
+KDT_TARGET_AVX512
+static uint64_t __KDT_partition_le_avx512(vertex_t* v, const uint64_t n, const int axis, const double pivot)
+{
+	return __KDT_block_partition(v, axis, NULL, NULL, n, pivot, KDT_ISA_AVX512);
+}
+
+KDT_TARGET_AVX512
+static uint64_t __KDT_keys_partition_le_avx512(double* key, uint32_t* index, const uint64_t n, const double pivot)
+{
+	return __KDT_block_partition(NULL, 0, key, index, n, pivot, KDT_ISA_AVX512);
+}
+
+KDT_TARGET_AVX2
+static uint64_t __KDT_keys_partition_le_avx2(double* key, uint32_t* index, const uint64_t n, const double pivot)
+{
+	return __KDT_block_partition(NULL, 0, key, index, n, pivot, KDT_ISA_AVX2);
+}
+#endif
+
+uint64_t KDT_partition_le(vertex_t* v, const uint64_t n, const int axis, const double pivot)
+{
+#ifdef KDT_X86_SIMD
+	if ( KDT_cpu_has_avx512() )
+		return __KDT_partition_le_avx512(v, n, axis, pivot);
+#endif
+	return __KDT_block_partition(v, axis, NULL, NULL, n, pivot, KDT_ISA_SCALAR);
+}
+
+uint64_t KDT_keys_partition_le(double* key, uint32_t* index, const uint64_t n, const double pivot)
+{
+#ifdef KDT_X86_SIMD
+	if ( KDT_cpu_has_avx512() )
+		return __KDT_keys_partition_le_avx512(key, index, n, pivot);
+	if ( KDT_cpu_has_avx2() )
+		return __KDT_keys_partition_le_avx2(key, index, n, pivot);
+#endif
+	return __KDT_block_partition(NULL, 0, key, index, n, pivot, KDT_ISA_SCALAR);
+}
+
+// Intervalo [begin, end) de posições do array
+typedef struct {
+	uint64_t begin;
+	uint64_t end;
+} kd_range_t;
+
+// Localiza a k-ésima posição de uma lista de intervalos
+static void __KDT_range_seek(const kd_range_t* range, uint64_t k, int* r, uint64_t* pos)
+{
+	int i = 0;
+	while ( k >= range[i].end - range[i].begin )
+	{
+		k -= range[i].end - range[i].begin;
+		i++;
+	}
+
+	*r = i;
+	*pos = range[i].begin + k;
+}
+
+// Versão paralela das partições. Cada tarefa particiona um bloco contíguo; depois, os
+// pontos > pivot que ficaram antes da fronteira global são trocados, aos pares e
+// também em paralelo, com os pontos <= pivot que ficaram depois dela. Com
+// key != NULL, particiona as chaves compactas em vez dos registros v.
+static uint64_t __KDT_parallel_partition(vertex_t* v, const int axis, double* key, uint32_t* index,
+                                         const uint64_t n, const double pivot)
+{
+	uint64_t count[KDT_MAX_PARTITION_TASKS];
+	kd_range_t high[KDT_MAX_PARTITION_TASKS];	// pontos > pivot antes da fronteira
+	kd_range_t low[KDT_MAX_PARTITION_TASKS];	// pontos <= pivot depois da fronteira
+
+	const int num_tasks = KDT_partition_tasks(n);
+
+	#pragma omp taskloop default(none) shared(v, key, index, count) firstprivate(n, axis, pivot, num_tasks) num_tasks(num_tasks)
+	for (int t = 0; t < num_tasks; t++)
+	{
+		uint64_t begin = n*t/num_tasks;
+		uint64_t end = n*(t + 1)/num_tasks;
+		count[t] = key != NULL ? KDT_keys_partition_le(key + begin, index + begin, end - begin, pivot)
+		                       : KDT_partition_le(v + begin, end - begin, axis, pivot);
+	}
+
+	uint64_t split = 0;
+	for (int t = 0; t < num_tasks; t++)
+		split += count[t];
+
+	// Lista os pontos fora do lugar
+	int num_high = 0, num_low = 0;
+	uint64_t misplaced = 0;
+	for (int t = 0; t < num_tasks; t++)
+	{
+		uint64_t begin = n*t/num_tasks;
+		uint64_t middle = begin + count[t];
+		uint64_t end = n*(t + 1)/num_tasks;
+
+		if ( middle < split && middle < end )
+		{
+			high[num_high].begin = middle;
+			high[num_high].end = end < split ? end : split;
+			misplaced += high[num_high].end - middle;
+			num_high++;
+		}
+
+		if ( middle > split && begin < middle )
+		{
+			low[num_low].begin = begin > split ? begin : split;
+			low[num_low].end = middle;
+			num_low++;
+		}
+	}
+
+	if ( misplaced == 0 )
+		return split;
+
+	#pragma omp taskloop default(none) shared(v, key, index, high, low) firstprivate(misplaced, num_tasks) num_tasks(num_tasks)
+	for (int t = 0; t < num_tasks; t++)
+	{
+		uint64_t k = misplaced*t/num_tasks;
+		uint64_t last = misplaced*(t + 1)/num_tasks;
+		if ( k == last )
+			continue;
+
+		int h, l;
+		uint64_t i, j;
+		__KDT_range_seek(high, k, &h, &i);
+		__KDT_range_seek(low, k, &l, &j);
+
+		for (; k < last; k++)
+		{
+			if ( i == high[h].end )
+				i = high[++h].begin;
+			if ( j == low[l].end )
+				j = low[++l].begin;
+
+			if ( key != NULL )
+				__KDT_swap_keys(key, index, i++, j++);
+			else
+				__swapVertices(&v[i++], &v[j++]);
+		}
+	}
+
+	return split;
+}
+
+uint64_t KDT_parallel_partition_le(vertex_t* v, const uint64_t n, const int axis, const double pivot)
+{
+	return __KDT_parallel_partition(v, axis, NULL, NULL, n, pivot);
+}
+
+uint64_t KDT_keys_parallel_partition_le(double* key, uint32_t* index, const uint64_t n, const double pivot)
+{
+	return __KDT_parallel_partition(NULL, 0, key, index, n, pivot);
+}
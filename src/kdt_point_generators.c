@@ -1,83 +1,148 @@
-#include <xoroshiro256plusplus.h>
+// No fused multiply-adds: the datasets must be bit-identical on every target,
+// whatever -march the file is compiled with
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <hxt_vertices.h>
+#include <kdt_random.h>
 
 static uint64_t default_seed = 1234567890ULL;
 
-void points_within_axes(vertex_t* vertices, uint32_t npts)
+// Points per block. Block b draws from the seeded stream advanced by b long jumps
+// of 2^192 draws, so every point is the same whatever the number of threads
+#define KDT_GENERATOR_BLOCK 65536
+
+// Points whose variates are drawn in one batch
+#define KDT_GENERATOR_BATCH 512
+
+// Uniform and normal variates per point, at most
+#define KDT_GENERATOR_MAX_DRAWS 3
+
+// Generator parameters
+typedef struct {
+    uint32_t npts;
+    double h;
+    uint32_t resolution;
+} kd_generator_t;
+
+// Generates each point with point(i, uniforms, normals, parameters, coordinates):
+// the nu uniform and nn normal variates of every point of a batch are drawn at once
+// by the batch generator. Threads take contiguous ranges of blocks and jump ahead
+// to the start of their range
+static inline void __KDT_generate(vertex_t* vertices, const kd_generator_t* g, int nu, int nn,
+                                  void (*point)(uint32_t, const double*, const double*, const kd_generator_t*, double*))
 {
-    double sdx = 1e-2; // standard deviation
-    double sdy = 1e-2;
-    double sdz = 1e-2;
+    kd_random_t seed;
+    KDT_random_seed(&seed, default_seed);
+    uint32_t nblocks = (g->npts + KDT_GENERATOR_BLOCK - 1) / KDT_GENERATOR_BLOCK;
+
+    #pragma omp parallel if(nblocks > 1)
+    {
+        int nthreads = 1, thread = 0;
+#ifdef _OPENMP
+        nthreads = omp_get_num_threads();
+        thread = omp_get_thread_num();
+#endif
+        uint32_t first = (uint64_t) nblocks * thread / nthreads;
+        uint32_t last = (uint64_t) nblocks * (thread + 1) / nthreads;
+
+        kd_random_t stream = seed;
+        for (uint32_t b = 0; b < first; b++)
+            KDT_random_long_jump(&stream);
+
+        double u[KDT_GENERATOR_MAX_DRAWS * KDT_GENERATOR_BATCH];
+        double n[KDT_GENERATOR_MAX_DRAWS * KDT_GENERATOR_BATCH];
+        for (uint32_t b = first; b < last; b++) {
+            kd_random4_t rng4;
+            KDT_random4_init(&rng4, &stream);
+
+            uint32_t end = (uint64_t) (b + 1) * KDT_GENERATOR_BLOCK < g->npts ? (b + 1) * KDT_GENERATOR_BLOCK : g->npts;
+            for (uint32_t i = b * KDT_GENERATOR_BLOCK; i < end; i += KDT_GENERATOR_BATCH) {
+                uint32_t m = end - i < KDT_GENERATOR_BATCH ? end - i : KDT_GENERATOR_BATCH;
+                KDT_random4_uniform(&rng4, u, (size_t) nu * m);
+                KDT_random4_normal(&rng4, n, (size_t) nn * m);
+                for (uint32_t k = 0; k < m; k++)
+                    point(i + k, u + nu*k, n + nn*k, g, vertices[i + k].coord);
+            }
+            KDT_random_long_jump(&stream);
+        }
+    }
+}
 
-    uint32_t third = npts / 3;
+static inline void __KDT_axes_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    double sd = 1e-2; // standard deviation
+    uint32_t third = g->npts / 3;
+
+    // Points along the axis x, y or z
+    int axis = i < third ? 0 : (i < 2*third ? 1 : 2);
+    for (int j = 0; j < 3; j++)
+        p[j] = n[j] * sd;
+    p[axis] += u[0];
+}
 
-    xoroshiro256plusplus_seed(default_seed);
+void points_within_axes(vertex_t* vertices, uint32_t npts)
+{
+    kd_generator_t g = { npts, 0.0, 0 };
+    __KDT_generate(vertices, &g, 1, 3, __KDT_axes_point);
+}
 
-    // Points on the plane xy
-    for (uint32_t i = 0; i < third; i++) {
-        vertices[i].coord[0] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = nxoroshiro256plusplus_d() * sdz;
-    }
+static inline void __KDT_cube_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) i;
+    (void) n;
+    (void) g;
+    p[0] = u[0];
+    p[1] = u[1];
+    p[2] = u[2];
+}
 
-    // Points on the plane yz
-    for (uint32_t i = third; i < 2*third; i++) {
-        vertices[i].coord[0] = nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = nxoroshiro256plusplus_d() * sdz;
-    }
+void points_within_cube(vertex_t* vertices, uint32_t npts)
+{
+    kd_generator_t g = { npts, 0.0, 0 };
+    __KDT_generate(vertices, &g, 3, 0, __KDT_cube_point);
+}
 
-    // Points on the plane zx
-    for (uint32_t i = 2*third; i < npts; i++) {
-        vertices[i].coord[0] = nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdz;
-    }
+// Uniform point within the unit disk
+static inline void __KDT_disk(const double* u, double* x, double* y)
+{
+    double theta = 2 * M_PI * u[0];
+    double r = sqrt(u[1]);
+    *x = r * sin(theta);
+    *y = r * cos(theta);
 }
 
-void points_within_cube(vertex_t* vertices, uint32_t npts)
+// add gaussian noise
+static inline void __KDT_add_noise(const double* n, double* p, double sdx, double sdy, double sdz)
 {
-    xoroshiro256plusplus_seed(default_seed);
+    p[0] += sdx * n[0];
+    p[1] += sdy * n[1];
+    p[2] += sdz * n[2];
+}
 
-    for (uint32_t i=0; i<npts; i++) {
-    vertices[i].coord[0] = xoroshiro256plusplus_d();
-    vertices[i].coord[1] = xoroshiro256plusplus_d();
-    vertices[i].coord[2] = xoroshiro256plusplus_d();
-  }
+static inline void __KDT_cylinder_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) i;
+    __KDT_disk(u, &p[0], &p[1]);
+    p[2] = g->h * (u[2] - 0.5);
+    __KDT_add_noise(n, p, 1e-2, 1e-2, 1e-2);
 }
 
 void points_within_cylinder(vertex_t* vertices, uint32_t npts, double h)
 {
-    double R = 1.0; // radius
-
-    xoroshiro256plusplus_seed(default_seed);
-
-    for (uint32_t i = 0; i < npts; i++) {
-        double theta = 2 * M_PI * xoroshiro256plusplus_d();
-        double r = R * sqrt(xoroshiro256plusplus_d());
-        double x = r * sin(theta);
-        double y = r * cos(theta);
-        double z = h * (xoroshiro256plusplus_d() - 0.5);
-
-        // add gaussian noise
-        double sdx = 1e-2; // standard deviation in x
-        double sdy = 1e-2; // standard deviation in y
-        double sdz = 1e-2; // standard deviation in z
-        x += sdx * nxoroshiro256plusplus_d();
-        y += sdy * nxoroshiro256plusplus_d();
-        z += sdz * nxoroshiro256plusplus_d();
-
-        vertices[i].coord[0] = x;
-        vertices[i].coord[1] = y;
-        vertices[i].coord[2] = z;
-    }
+    kd_generator_t g = { npts, h, 0 };
+    __KDT_generate(vertices, &g, 3, 3, __KDT_cylinder_point);
 }
 
 void points_from_Liu(vertex_t* vertices)
 {
-    xoroshiro256plusplus_seed(default_seed);
-
     vertices[0].coord[0] = 2.880;
     vertices[0].coord[1] = 64.490;
     vertices[0].coord[2] = 0.0;
@@ -154,116 +219,92 @@ void points_from_Liu(vertex_t* vertices)
     vertices[14].dist = 15;
 }
 
-void points_within_planes(vertex_t* vertices, uint32_t npts)
+static inline void __KDT_planes_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
 {
-    double sdx = 1e-2; // standard deviation in x
-    double sdy = 1e-2; // standard deviation in y
-    double sdz = 1e-2; // standard deviation in z
-
-    uint32_t third = npts / 3;
-
-    xoroshiro256plusplus_seed(default_seed);
-
-    // plane points xy
-    for (uint32_t i = 0; i < third; i++) {
-        vertices[i].coord[0] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = nxoroshiro256plusplus_d() * sdz;
-    }
+    double sd = 1e-2; // standard deviation
+    uint32_t third = g->npts / 3;
+
+    // plane points xy, yz or zx: the normal axis gets only noise
+    int normal = i < third ? 2 : (i < 2*third ? 0 : 1);
+    p[normal] = 0.0;
+    p[(normal + 1) % 3] = u[0];
+    p[(normal + 2) % 3] = u[1];
+    for (int j = 0; j < 3; j++)
+        p[j] += n[j] * sd;
+}
 
-    // plane points yz
-    for (uint32_t i = third; i < 2*third; i++) {
-        vertices[i].coord[0] = nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdz;
-    }
+void points_within_planes(vertex_t* vertices, uint32_t npts)
+{
+    kd_generator_t g = { npts, 0.0, 0 };
+    __KDT_generate(vertices, &g, 2, 3, __KDT_planes_point);
+}
 
-    // plane points zx
-    for (uint32_t i = 2*third; i < npts; i++) {
-        vertices[i].coord[0] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdx;
-        vertices[i].coord[1] = nxoroshiro256plusplus_d() * sdy;
-        vertices[i].coord[2] = xoroshiro256plusplus_d() + nxoroshiro256plusplus_d() * sdz;
-    }
+static inline void __KDT_paraboloid_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) i;
+    (void) g;
+    __KDT_disk(u, &p[0], &p[1]);
+    p[2] = p[0]*p[0] + p[1]*p[1];
+    __KDT_add_noise(n, p, 1e-2, 1e-2, 1e-2);
 }
 
 void points_within_paraboloid(vertex_t* vertices, uint32_t npts)
 {
-    double R = 1.0; // ray
-
-    xoroshiro256plusplus_seed(default_seed);
-
-    for (uint32_t i = 0; i < npts; i++) {
-        double theta = 2 * M_PI * xoroshiro256plusplus_d();
-        double r = R * sqrt(xoroshiro256plusplus_d());
-        double x = r * sin(theta);
-        double y = r * cos(theta);
-        double z = pow(x, 2) + pow(y, 2);
-
-        // add gaussian noise
-        double sdx = 1e-2; // standard deviation in x
-        double sdy = 1e-2; // standard deviation in y
-        double sdz = 1e-2; // standard deviation in z
-        x += sdx * nxoroshiro256plusplus_d();
-        y += sdy * nxoroshiro256plusplus_d();
-        z += sdz * nxoroshiro256plusplus_d();
-
-        vertices[i].coord[0] = x;
-        vertices[i].coord[1] = y;
-        vertices[i].coord[2] = z;
-    }
+    kd_generator_t g = { npts, 0.0, 0 };
+    __KDT_generate(vertices, &g, 2, 3, __KDT_paraboloid_point);
+}
+
+static inline void __KDT_spiral_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) u;
+    double u0 = i * g->h;
+    double theta = 2 * M_PI * sqrt(u0);
+    double alpha = 0.5;
+    double beta = 0.01;
+    double gamma = 1.0;
+    p[0] = alpha * theta * exp(beta * theta) * sin(theta);
+    p[1] = alpha * theta * exp(beta * theta) * cos(theta);
+    p[2] = gamma * theta;
+    __KDT_add_noise(n, p, 5e-1, 5e-1, 1e0);
 }
 
 void points_within_spiral(vertex_t* vertices, uint32_t npts)
 {
     double a = 0.25 / M_PI;
     double b = 300.0;
-    double h = (b-a)/(npts-1);
-
-    xoroshiro256plusplus_seed(default_seed);
-
-    for (uint32_t i = 0; i < npts; i++) {
-        double u0 = i*h;
-        double theta = 2 * M_PI * sqrt(u0);
-        double alpha = 0.5;
-        double beta = 0.01;
-        double gamma = 1.0;
-        double x = alpha * theta * exp(beta * theta) * sin(theta);
-        double y = alpha * theta * exp(beta * theta) * cos(theta);
-        double z = gamma * theta;
-
-        // add gaussian noise
-        double sdx = 5e-1; // standard deviation in x
-        double sdy = 5e-1; // standard deviation in y
-        double sdz = 1e0;  // standard deviation in z
-        x += sdx * nxoroshiro256plusplus_d();
-        y += sdy * nxoroshiro256plusplus_d();
-        z += sdz * nxoroshiro256plusplus_d();
-
-        vertices[i].coord[0] = x;
-        vertices[i].coord[1] = y;
-        vertices[i].coord[2] = z;
-    }
+    kd_generator_t g = { npts, (b-a)/(npts-1), 0 };
+    __KDT_generate(vertices, &g, 0, 3, __KDT_spiral_point);
+}
+
+static inline void __KDT_saddle_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) i;
+    (void) g;
+    p[0] = 2*u[0] - 1.0;
+    p[1] = 2*u[1] - 1.0;
+    p[2] = p[0]*p[0] - p[1]*p[1];
+    __KDT_add_noise(n, p, 1e-2, 1e-2, 1e-2);
 }
 
 void points_around_saddle(vertex_t* vertices, uint32_t npts)
 {
-    xoroshiro256plusplus_seed(default_seed);
-
-    for (uint32_t i = 0; i < npts; i++) {
-        double x = 2*xoroshiro256plusplus_d() - 1.0;
-        double y = 2*xoroshiro256plusplus_d() - 1.0;
-        double z = x*x - y*y;
-
-        // add gaussian noise
-        double sdx = 1e-2; // standard deviation in x
-        double sdy = 1e-2; // standard deviation in y
-        double sdz = 1e-2; // standard deviation in z
-        x += sdx * nxoroshiro256plusplus_d();
-        y += sdy * nxoroshiro256plusplus_d();
-        z += sdz * nxoroshiro256plusplus_d();
-
-        vertices[i].coord[0] = x;
-        vertices[i].coord[1] = y;
-        vertices[i].coord[2] = z;
-    }
+    kd_generator_t g = { npts, 0.0, 0 };
+    __KDT_generate(vertices, &g, 2, 3, __KDT_saddle_point);
+}
+
+// Points within the unit cube snapped to a regular grid with resolution cells
+// per axis, like a scan quantized to a fixed step: each coordinate value is
+// shared by about npts/resolution points
+static inline void __KDT_grid_point(uint32_t i, const double* u, const double* n, const kd_generator_t* g, double* p)
+{
+    (void) i;
+    (void) n;
+    for (int j = 0; j < 3; j++)
+        p[j] = floor(u[j] * g->resolution) / g->resolution;
+}
+
+void points_on_grid(vertex_t* vertices, uint32_t npts, uint32_t resolution)
+{
+    kd_generator_t g = { npts, 0.0, resolution };
+    __KDT_generate(vertices, &g, 3, 0, __KDT_grid_point);
 }
@@ -0,0 +1,434 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#include <string.h>
+
+#include <kdt_random.h>
+#include <kdt_simd.h>
+
+// Sorteios brutos guardados de cada vez pela ziggurat
+#define KDT_RANDOM_BUFFER 256
+
+// Início da cauda da ziggurat de 256 camadas (Marsaglia e Tsang)
+#define KDT_ZIGGURAT_R 3.6541528853610088
+
+// Tabelas da ziggurat para mantissas de 52 bits: a camada i aceita direto se a
+// mantissa é menor que k[i]; w[i] converte a mantissa em x e f[i] = exp(-x_i^2/2)
+static const uint64_t __KDT_zig_k[256] = {
+	UINT64_C(0xef33d8025bc39), UINT64_C(0x0000000000000), UINT64_C(0xc08be98f2acaa), UINT64_C(0xda354faba4236),
+	UINT64_C(0xe51f67ec049b5), UINT64_C(0xeb255e9d2fa41), UINT64_C(0xeef4b817e221c), UINT64_C(0xf19470af9cc80),
+	UINT64_C(0xf37ed61ff712f), UINT64_C(0xf4f469560df95), UINT64_C(0xf61a5e41b6be3), UINT64_C(0xf707a75536926),
+	UINT64_C(0xf7cb2ec281ec3), UINT64_C(0xf86f10c6337d8), UINT64_C(0xf8fa657830a7d), UINT64_C(0xf9724c74db926),
+	UINT64_C(0xf9da907dbe051), UINT64_C(0xfa360f581e82e), UINT64_C(0xfa86fde5b3bbf), UINT64_C(0xfacf160d34659),
+	UINT64_C(0xfb0fb6718ac00), UINT64_C(0xfb49f8d5368f8), UINT64_C(0xfb7ec2366f3bd), UINT64_C(0xfbaece9a1db42),
+	UINT64_C(0xfbdab9d0402f5), UINT64_C(0xfc03060ff6415), UINT64_C(0xfc28210379aaa), UINT64_C(0xfc4a67ae254c2),
+	UINT64_C(0xfc6a2977ae7a3), UINT64_C(0xfc87aa928908b), UINT64_C(0xfca325e4bd8d4), UINT64_C(0xfcbcce9021dc6),
+	UINT64_C(0xfcd4d12f834c6), UINT64_C(0xfceb54d8fe7e7), UINT64_C(0xfd007bf1dc4c6), UINT64_C(0xfd1464dd6c0ba),
+	UINT64_C(0xfd272a8e2f060), UINT64_C(0xfd38e4ff0c565), UINT64_C(0xfd49a9990b0f2), UINT64_C(0xfd598b8920bf9),
+	UINT64_C(0xfd689c08e96bd), UINT64_C(0xfd76ea9c8e52a), UINT64_C(0xfd848547b0606), UINT64_C(0xfd9178bad29cb),
+	UINT64_C(0xfd9dd07a7ab31), UINT64_C(0xfda9970105c08), UINT64_C(0xfdb4d5dc02bb8), UINT64_C(0xfdbf95c5bfa83),
+	UINT64_C(0xfdc9debb99848), UINT64_C(0xfdd3b8118707f), UINT64_C(0xfddd288342d86), UINT64_C(0xfde6364369d6f),
+	UINT64_C(0xfdeee708d4f6d), UINT64_C(0xfdf7401a6b25e), UINT64_C(0xfdff46599eb80), UINT64_C(0xfe06fe4bc2343),
+	UINT64_C(0xfe0e6c225a0b8), UINT64_C(0xfe1593c28b6ba), UINT64_C(0xfe1c78cbc3e15), UINT64_C(0xfe231e9db1b32),
+	UINT64_C(0xfe29885da1a27), UINT64_C(0xfe2fb8fb54027), UINT64_C(0xfe35b33558bf6), UINT64_C(0xfe3b799cffee1),
+	UINT64_C(0xfe410e99eac3f), UINT64_C(0xfe46746d475ff), UINT64_C(0xfe4bad34c082f), UINT64_C(0xfe50baed29401),
+	UINT64_C(0xfe559f74ebb5c), UINT64_C(0xfe5a5c8e410ff), UINT64_C(0xfe5ef3e13857d), UINT64_C(0xfe6366fd90f74),
+	UINT64_C(0xfe67b75c6d47c), UINT64_C(0xfe6be661e10b4), UINT64_C(0xfe6ff55e5f402), UINT64_C(0xfe73e5900a617),
+	UINT64_C(0xfe77b823e9d56), UINT64_C(0xfe7b6e3706fc3), UINT64_C(0xfe7f08d77416b), UINT64_C(0xfe8289053efb9),
+	UINT64_C(0xfe85efb35166d), UINT64_C(0xfe893dc84079b), UINT64_C(0xfe8c741f0cdf7), UINT64_C(0xfe8f9387d4e36),
+	UINT64_C(0xfe929cc879a62), UINT64_C(0xfe95909d38833), UINT64_C(0xfe986fb9399ee), UINT64_C(0xfe9b3ac7147b7),
+	UINT64_C(0xfe9df2694b62a), UINT64_C(0xfea0973abe5d4), UINT64_C(0xfea329cf16600), UINT64_C(0xfea5aab32948c),
+	UINT64_C(0xfea81a6d5737c), UINT64_C(0xfeaa797de1c56), UINT64_C(0xfeacc85f3d889), UINT64_C(0xfeaf07865e5a9),
+	UINT64_C(0xfeb13762feb82), UINT64_C(0xfeb3585fe29bd), UINT64_C(0xfeb56ae316229), UINT64_C(0xfeb76f4e28470),
+	UINT64_C(0xfeb965fe61f8d), UINT64_C(0xfebb4f4cf9cf9), UINT64_C(0xfebd2b8f4494f), UINT64_C(0xfebefb16e2dbf),
+	UINT64_C(0xfec0be31ebd6c), UINT64_C(0xfec2752b1599a), UINT64_C(0xfec42049daf5b), UINT64_C(0xfec5bfd29f121),
+	UINT64_C(0xfec75406cee81), UINT64_C(0xfec8dd2500c42), UINT64_C(0xfeca5b6911ea1), UINT64_C(0xfecbcf0c42790),
+	UINT64_C(0xfecd38454faa9), UINT64_C(0xfece97488c84a), UINT64_C(0xfecfec47f914f), UINT64_C(0xfed13773584c1),
+	UINT64_C(0xfed278f84489e), UINT64_C(0xfed3b10242ee8), UINT64_C(0xfed4dfbad580b), UINT64_C(0xfed605498c37c),
+	UINT64_C(0xfed721d414f89), UINT64_C(0xfed8357e4a924), UINT64_C(0xfed9406a42c6d), UINT64_C(0xfeda42b85b6a9),
+	UINT64_C(0xfedb3c8746a5a), UINT64_C(0xfedc2df4165fa), UINT64_C(0xfedd171a46dfc), UINT64_C(0xfeddf813c8a7d),
+	UINT64_C(0xfeded0f90992c), UINT64_C(0xfedfa1e0fd3c1), UINT64_C(0xfee06ae124b73), UINT64_C(0xfee12c0d959b5),
+	UINT64_C(0xfee1e57900690), UINT64_C(0xfee29734b64d6), UINT64_C(0xfee34150ae46f), UINT64_C(0xfee3e3db89af0),
+	UINT64_C(0xfee47ee2982a8), UINT64_C(0xfee51271db03c), UINT64_C(0xfee59e9407ef7), UINT64_C(0xfee623528b3e5),
+	UINT64_C(0xfee6a0b5897a9), UINT64_C(0xfee716c3e0733), UINT64_C(0xfee7858327b3b), UINT64_C(0xfee7ecf7b0674),
+	UINT64_C(0xfee84d2484a6e), UINT64_C(0xfee8a60b662ff), UINT64_C(0xfee8f7accc80f), UINT64_C(0xfee94207e2598),
+	UINT64_C(0xfee9851a829aa), UINT64_C(0xfee9c0e13481a), UINT64_C(0xfee9f557273b4), UINT64_C(0xfeea22762cc70),
+	UINT64_C(0xfeea4836b426d), UINT64_C(0xfeea668fc2d34), UINT64_C(0xfeea7d76ed6bd), UINT64_C(0xfeea8ce04f9ce),
+	UINT64_C(0xfeea94be83300), UINT64_C(0xfeea9502963d4), UINT64_C(0xfeea8d9c00723), UINT64_C(0xfeea7e789761a),
+	UINT64_C(0xfeea678481cec), UINT64_C(0xfeea48aa29e4a), UINT64_C(0xfeea21d22e4a2), UINT64_C(0xfee9f2e351fed),
+	UINT64_C(0xfee9bbc26aef8), UINT64_C(0xfee97c524f2ad), UINT64_C(0xfee93473c0a03), UINT64_C(0xfee8e405574e0),
+	UINT64_C(0xfee88ae369c44), UINT64_C(0xfee828e7f3dc9), UINT64_C(0xfee7bdea7b854), UINT64_C(0xfee749bff37cb),
+	UINT64_C(0xfee6cc3a9bd2c), UINT64_C(0xfee64529e004d), UINT64_C(0xfee5b45a32857), UINT64_C(0xfee51994e5785),
+	UINT64_C(0xfee474a00069e), UINT64_C(0xfee3c53e12c1e), UINT64_C(0xfee30b2e02aa7), UINT64_C(0xfee2462ad81d4),
+	UINT64_C(0xfee175eb83c2a), UINT64_C(0xfee09a22a1417), UINT64_C(0xfedfb27e3499c), UINT64_C(0xfedebea76213e),
+	UINT64_C(0xfeddbe422044f), UINT64_C(0xfedcb0ece39a5), UINT64_C(0xfedb964042cc6), UINT64_C(0xfeda6dce9389c),
+	UINT64_C(0xfed937237e95f), UINT64_C(0xfed7f1c38a80a), UINT64_C(0xfed69d2b9bffe), UINT64_C(0xfed538d06add3),
+	UINT64_C(0xfed3c41dea3f7), UINT64_C(0xfed23e76a2fac), UINT64_C(0xfed0a732fe617), UINT64_C(0xfecefda07fe08),
+	UINT64_C(0xfecd4100eb78c), UINT64_C(0xfecb708956e89), UINT64_C(0xfec98b6123096), UINT64_C(0xfec790a0da94e),
+	UINT64_C(0xfec57f50f31d4), UINT64_C(0xfec356686c938), UINT64_C(0xfec114cb4b30b), UINT64_C(0xfebeb948e6fa7),
+	UINT64_C(0xfebc429a0b668), UINT64_C(0xfeb9af5ee0cb3), UINT64_C(0xfeb6fe1c98519), UINT64_C(0xfeb42d3ad1f75),
+	UINT64_C(0xfeb13b00b2d23), UINT64_C(0xfeae2591a02c0), UINT64_C(0xfeaaeae99222d), UINT64_C(0xfea788d8ee2fe),
+	UINT64_C(0xfea3fcffd73bc), UINT64_C(0xfea044c8dd9ce), UINT64_C(0xfe9c5d62f5612), UINT64_C(0xfe9843ba9477a),
+	UINT64_C(0xfe93f471d4700), UINT64_C(0xfe8f6bd76c5ad), UINT64_C(0xfe8aa5dc4e8bd), UINT64_C(0xfe859e07ab1c1),
+	UINT64_C(0xfe804f690a917), UINT64_C(0xfe7ab48823396), UINT64_C(0xfe74c751f6a7c), UINT64_C(0xfe6e8102aa1d9),
+	UINT64_C(0xfe67da0b6abaf), UINT64_C(0xfe60c9f383055), UINT64_C(0xfe5947338f718), UINT64_C(0xfe51470977256),
+	UINT64_C(0xfe48bd436f42d), UINT64_C(0xfe3f9bffd1e0d), UINT64_C(0xfe35d35eeb171), UINT64_C(0xfe2b5122fe4d2),
+	UINT64_C(0xfe2000399552b), UINT64_C(0xfe13c827882e8), UINT64_C(0xfe068c4ee6783), UINT64_C(0xfdf82b02b717d),
+	UINT64_C(0xfde87c57efe7c), UINT64_C(0xfdd7509c63bce), UINT64_C(0xfdc46e529bee3), UINT64_C(0xfdaf8f82e0252),
+	UINT64_C(0xfd985e1b2ba43), UINT64_C(0xfd7e6ef48ced0), UINT64_C(0xfd613adbd64d6), UINT64_C(0xfd40149e2efda),
+	UINT64_C(0xfd1a1a7b4c772), UINT64_C(0xfcee204761f61), UINT64_C(0xfcba8d85e1171), UINT64_C(0xfc7d26ecd2cde),
+	UINT64_C(0xfc32b2f1e22a1), UINT64_C(0xfbd6581c0b7e7), UINT64_C(0xfb606c40053d6), UINT64_C(0xfac40582a2805),
+	UINT64_C(0xf9e971e014510), UINT64_C(0xf89fa48a41d49), UINT64_C(0xf66c5f7f02f1a), UINT64_C(0xf1a5a4b331a0a)
+};
+
+static const double __KDT_zig_w[256] = {
+	0x1.f493b78164498p-51, 0x1.b8d0be3d69918p-55, 0x1.250af3c200a69p-54, 0x1.57cb9383ae550p-54,
+	0x1.801fce827fac5p-54, 0x1.a230c2e46389ep-54, 0x1.c004d2f328d93p-54, 0x1.dac2f5a6f3120p-54,
+	0x1.f32482d4807a6p-54, 0x1.04d32278c832ep-53, 0x1.0f5053b004b4ep-53, 0x1.192a6973f450ap-53,
+	0x1.227a28f78456ap-53, 0x1.2b52e38621b30p-53, 0x1.33c3fc055e9edp-53, 0x1.3bd9ec1a11c06p-53,
+	0x1.439ef8dfe170ap-53, 0x1.4b1bb363c898dp-53, 0x1.5257562196c1cp-53, 0x1.59580a70673c9p-53,
+	0x1.60231cfd82f9bp-53, 0x1.66bd261a2377ep-53, 0x1.6d2a291feca73p-53, 0x1.736dad345c6b6p-53,
+	0x1.798ad10b200f0p-53, 0x1.7f845ad45d397p-53, 0x1.855cc5341f023p-53, 0x1.8b1649e7a632cp-53,
+	0x1.90b2ea94dc2a8p-53, 0x1.96347822b1818p-53, 0x1.9b9c98e37c43bp-53, 0x1.a0eccdca3ab98p-53,
+	0x1.a62676d76d6f5p-53, 0x1.ab4ad6e0f24bap-53, 0x1.b05b16d127fd5p-53, 0x1.b5584874191dap-53,
+	0x1.ba4368e51bb30p-53, 0x1.bf1d62abea23bp-53, 0x1.c3e70f95872e0p-53, 0x1.c8a13a531630bp-53,
+	0x1.cd4c9fe7151cap-53, 0x1.d1e9f0e7fe5f7p-53, 0x1.d679d29e3510dp-53, 0x1.dafce0022edeep-53,
+	0x1.df73aa9f0ae8dp-53, 0x1.e3debb5d2292dp-53, 0x1.e83e93379ad08p-53, 0x1.ec93abdf8c395p-53,
+	0x1.f0de784efa595p-53, 0x1.f51f654d83c88p-53, 0x1.f956d9e87202bp-53, 0x1.fd8537df97991p-53,
+	0x1.00d56e041db89p-52, 0x1.02e40f5393759p-52, 0x1.04eea9e164ed4p-52, 0x1.06f565b7249f9p-52,
+	0x1.08f8690719efdp-52, 0x1.0af7d84bc0d06p-52, 0x1.0cf3d664b796dp-52, 0x1.0eec84b15b64dp-52,
+	0x1.10e203294c4bdp-52, 0x1.12d470730bf74p-52, 0x1.14c3e9f8e41d8p-52, 0x1.16b08bfc3d191p-52,
+	0x1.189a71a788c7ep-52, 0x1.1a81b51ee20a3p-52, 0x1.1c666f8f7deb3p-52, 0x1.1e48b93e088dcp-52,
+	0x1.2028a99405610p-52, 0x1.2206572c47d17p-52, 0x1.23e1d7de97a07p-52, 0x1.25bb40ca92399p-52,
+	0x1.2792a661d8bcdp-52, 0x1.29681c7199017p-52, 0x1.2b3bb62b7e880p-52, 0x1.2d0d862e172a1p-52,
+	0x1.2edd9e8cb647fp-52, 0x1.30ac10d6e0469p-52, 0x1.3278ee1f4755fp-52, 0x1.3444470261b6ap-52,
+	0x1.360e2baca1034p-52, 0x1.37d6abe05165dp-52, 0x1.399dd6fb270e9p-52, 0x1.3b63bbfb7fc17p-52,
+	0x1.3d2869855dd80p-52, 0x1.3eebede721aacp-52, 0x1.40ae571e05f24p-52, 0x1.426fb2da63591p-52,
+	0x1.44300e83bf25ap-52, 0x1.45ef773ca8993p-52, 0x1.47adf9e6685eap-52, 0x1.496ba3248525ep-52,
+	0x1.4b287f6020506p-52, 0x1.4ce49acb2d5fdp-52, 0x1.4ea0016386a9cp-52, 0x1.505abef5e1a6dp-52,
+	0x1.5214df20a50d8p-52, 0x1.53ce6d56a2c3dp-52, 0x1.558774e1b7925p-52, 0x1.574000e552644p-52,
+	0x1.58f81c60e4c4cp-52, 0x1.5aafd2323e2fbp-52, 0x1.5c672d17d3b48p-52, 0x1.5e1e37b2f5545p-52,
+	0x1.5fd4fc89f270fp-52, 0x1.618b860a2e8ffp-52, 0x1.6341de8a27a41p-52, 0x1.64f8104b6f00cp-52,
+	0x1.66ae257c960d3p-52, 0x1.6864283b0fbf7p-52, 0x1.6a1a229507dcfp-52, 0x1.6bd01e8b30f36p-52,
+	0x1.6d86261289f28p-52, 0x1.6f3c43161c483p-52, 0x1.70f27f78b3573p-52, 0x1.72a8e5168e1a6p-52,
+	0x1.745f7dc70bc13p-52, 0x1.7616535e540adp-52, 0x1.77cd6faefc22dp-52, 0x1.7984dc8ba8bcbp-52,
+	0x1.7b3ca3c8ae294p-52, 0x1.7cf4cf3daf1d9p-52, 0x1.7ead68c73ae15p-52, 0x1.80667a486b99ep-52,
+	0x1.82200dac85645p-52, 0x1.83da2ce896f32p-52, 0x1.8594e1fd1c628p-52, 0x1.875036f7a4f7ep-52,
+	0x1.890c35f47c831p-52, 0x1.8ac8e92059192p-52, 0x1.8c865aba0de35p-52, 0x1.8e44951443c0ap-52,
+	0x1.9003a297387bcp-52, 0x1.91c38dc2855bcp-52, 0x1.9384612eeddb8p-52, 0x1.954627903758cp-52,
+	0x1.9708ebb70a936p-52, 0x1.98ccb892dfdbfp-52, 0x1.9a919933f6d92p-52, 0x1.9c5798cd5ad43p-52,
+	0x1.9e1ec2b6f486dp-52, 0x1.9fe7226faa6eap-52, 0x1.a1b0c39f90b75p-52, 0x1.a37bb21a29d81p-52,
+	0x1.a547f9e0b90efp-52, 0x1.a715a724a7f4dp-52, 0x1.a8e4c64a00726p-52, 0x1.aab563e9fc731p-52,
+	0x1.ac878cd5acc36p-52, 0x1.ae5b4e18b89dep-52, 0x1.b030b4fc37800p-52, 0x1.b207cf09a6f7ep-52,
+	0x1.b3e0aa0dfe361p-52, 0x1.b5bb541ce14a1p-52, 0x1.b797db93f6101p-52, 0x1.b9764f1e5cf51p-52,
+	0x1.bb56bdb84fdbep-52, 0x1.bd3936b2e992ep-52, 0x1.bf1dc9b81874ap-52, 0x1.c10486cebefa2p-52,
+	0x1.c2ed7e5f05369p-52, 0x1.c4d8c136de693p-52, 0x1.c6c6608ec60b5p-52, 0x1.c8b66e0eb8000p-52,
+	0x1.caa8fbd367ccdp-52, 0x1.cc9e1c73bb0eap-52, 0x1.ce95e3068bacap-52, 0x1.d0906328b6a39p-52,
+	0x1.d28db1037ca23p-52, 0x1.d48de1533a181p-52, 0x1.d691096e7cc94p-52, 0x1.d8973f4d7d74dp-52,
+	0x1.daa0999204a4dp-52, 0x1.dcad2f8fc2520p-52, 0x1.debd195520a7ep-52, 0x1.e0d06fb49ae98p-52,
+	0x1.e2e74c4ea23a7p-52, 0x1.e501c99c1ae6fp-52, 0x1.e72002f97db41p-52, 0x1.e94214b2a9c5cp-52,
+	0x1.eb681c0f74c90p-52, 0x1.ed923761084f7p-52, 0x1.efc086101ca9bp-52, 0x1.f1f328ac23146p-52,
+	0x1.f42a40fb72bc7p-52, 0x1.f665f20c8dff6p-52, 0x1.f8a6604897644p-52, 0x1.faebb187101b4p-52,
+	0x1.fd360d22fc6aep-52, 0x1.ff859c118d567p-52, 0x1.00ed447d3903dp-51, 0x1.021a8028fb929p-51,
+	0x1.034a983a8f2a6p-51, 0x1.047da4e3ee5dbp-51, 0x1.05b3bf6ada3acp-51, 0x1.06ed023a716b0p-51,
+	0x1.082988f631e79p-51, 0x1.0969708e892d0p-51, 0x1.0aacd7571b15ap-51, 0x1.0bf3dd1eec4f7p-51,
+	0x1.0d3ea34aa2df9p-51, 0x1.0e8d4cf115675p-51, 0x1.0fdffefa690b2p-51, 0x1.1136e04206156p-51,
+	0x1.129219bbb4e64p-51, 0x1.13f1d69c3fab5p-51, 0x1.1556448601f9dp-51, 0x1.16bf93b9de06ep-51,
+	0x1.182df74d203f5p-51, 0x1.19a1a564edd5ap-51, 0x1.1b1ad777f2157p-51, 0x1.1c99ca9719877p-51,
+	0x1.1e1ebfbe4a036p-51, 0x1.1fa9fc2e2cb18p-51, 0x1.213bc9d04beb3p-51, 0x1.22d477a6fc63bp-51,
+	0x1.24745a4ac8e8bp-51, 0x1.261bcc7764b62p-51, 0x1.27cb2faa84bcbp-51, 0x1.2982ecd770131p-51,
+	0x1.2b4375329fd27p-51, 0x1.2d0d43196ce88p-51, 0x1.2ee0db1a96c02p-51, 0x1.30becd256a217p-51,
+	0x1.32a7b5e6897e9p-51, 0x1.349c405ae0606p-51, 0x1.369d27a339bc1p-51, 0x1.38ab3925634a9p-51,
+	0x1.3ac7570ae7cb8p-51, 0x1.3cf27b316f883p-51, 0x1.3f2dbaa60e871p-51, 0x1.417a49cb9d9f6p-51,
+	0x1.43d98155452d1p-51, 0x1.464ce44a72e74p-51, 0x1.48d62759c383dp-51, 0x1.4b7739d6b4eccp-51,
+	0x1.4e3250dcd7dccp-51, 0x1.5109f53e9a131p-51, 0x1.54011523a7359p-51, 0x1.571b1a94ad95ap-51,
+	0x1.5a5c08b718342p-51, 0x1.5dc8a243ac693p-51, 0x1.61669cf86140fp-51, 0x1.653ce7b0060dfp-51,
+	0x1.69540be9fdbedp-51, 0x1.6db6b8d09d896p-51, 0x1.72728f05f70d7p-51, 0x1.779955608fd5bp-51,
+	0x1.7d42df4d6c5c3p-51, 0x1.839030529e9c6p-51, 0x1.8ab0fbfaa7412p-51, 0x1.92ee0946f3d1ap-51,
+	0x1.9cbee014050dfp-51, 0x1.a8fdc7894718cp-51, 0x1.b981f3878f995p-51, 0x1.d3bb48209ad33p-51
+};
+
+static const double __KDT_zig_f[256] = {
+	0x1.0000000000000p+0, 0x1.f446ac97c0265p-1, 0x1.eb7545b6e5a2dp-1, 0x1.e3f11e0296bb2p-1,
+	0x1.dd36fa70635f9p-1, 0x1.d70920658fa12p-1, 0x1.d144978a24289p-1, 0x1.cbd33a8a84602p-1,
+	0x1.c6a5eceaa82b8p-1, 0x1.c1b1cd9efb947p-1, 0x1.bceeb4ee2d08dp-1, 0x1.b85653a90e040p-1,
+	0x1.b3e3a8235bfdap-1, 0x1.af92a3f6dc413p-1, 0x1.ab5fef17af9c6p-1, 0x1.a748bd5519883p-1,
+	0x1.a34aafdf6780cp-1, 0x1.9f63bee65e399p-1, 0x1.9b9228d24c563p-1, 0x1.97d4657623514p-1,
+	0x1.94291c21c3052p-1, 0x1.908f1bd322352p-1, 0x1.8d0554fe6b8dcp-1, 0x1.898ad48bb899ap-1,
+	0x1.861ebfc3863d6p-1, 0x1.82c050f577355p-1, 0x1.7f6ed4b218395p-1, 0x1.7c29a779d0627p-1,
+	0x1.78f033ca14bc9p-1, 0x1.75c1f0771708dp-1, 0x1.729e5f44002a7p-1, 0x1.6f850baeb0dfbp-1,
+	0x1.6c7589e63eb25p-1, 0x1.696f75e51c96bp-1, 0x1.667272a936f1ep-1, 0x1.637e2985595dfp-1,
+	0x1.609249880ae0ap-1, 0x1.5dae86f4b84fep-1, 0x1.5ad29acc8e01cp-1, 0x1.57fe4264d0f30p-1,
+	0x1.55313f08e1e03p-1, 0x1.526b55a65eabbp-1, 0x1.4fac4e8213283p-1, 0x1.4cf3f4f49c91ep-1,
+	0x1.4a42172dccb23p-1, 0x1.479685fdfc714p-1, 0x1.44f114a49abddp-1, 0x1.425198a35d3b3p-1,
+	0x1.3fb7e9958cdc7p-1, 0x1.3d23e10afa266p-1, 0x1.3a955a6633c57p-1, 0x1.380c32bda6eadp-1,
+	0x1.358848bf5bd57p-1, 0x1.33097c970a541p-1, 0x1.308fafd64a29fp-1, 0x1.2e1ac55eaa449p-1,
+	0x1.2baaa14d7fc57p-1, 0x1.293f28e9432dbp-1, 0x1.26d8429056971p-1, 0x1.2475d5a913eccp-1,
+	0x1.2217ca9305a04p-1, 0x1.1fbe0a992f702p-1, 0x1.1d687fe54f920p-1, 0x1.1b17157402fa1p-1,
+	0x1.18c9b709b99bdp-1, 0x1.168051286962ap-1, 0x1.143ad105f04d3p-1, 0x1.11f924831795cp-1,
+	0x1.0fbb3a232b228p-1, 0x1.0d81010419aaap-1, 0x1.0b4a68d7130b1p-1, 0x1.091761d99b381p-1,
+	0x1.06e7dccf09138p-1, 0x1.04bbcafa69335p-1, 0x1.02931e18bd539p-1, 0x1.006dc85b91cdep-1,
+	0x1.fc9778c7c5ff1p-2, 0x1.f859da7a9a13dp-2, 0x1.f4229cb301990p-2, 0x1.eff1a717f2c62p-2,
+	0x1.ebc6e20bdba59p-2, 0x1.e7a236a4f5d07p-2, 0x1.e3838ea603307p-2, 0x1.df6ad4776cfd2p-2,
+	0x1.db57f320beac8p-2, 0x1.d74ad6427709cp-2, 0x1.d3436a102a142p-2, 0x1.cf419b4aeea8ep-2,
+	0x1.cb45573c135cbp-2, 0x1.c74e8bb0163b2p-2, 0x1.c35d26f1db70fp-2, 0x1.bf7117c61f2dep-2,
+	0x1.bb8a4d671f4cdp-2, 0x1.b7a8b780798d0p-2, 0x1.b3cc462b3b5fcp-2, 0x1.aff4e9ea20806p-2,
+	0x1.ac2293a5fdbd7p-2, 0x1.a85534aa55844p-2, 0x1.a48cbea213e9ep-2, 0x1.a0c923947011ep-2,
+	0x1.9d0a55e1f0f53p-2, 0x1.9950484193ad3p-2, 0x1.959aedbe1183bp-2, 0x1.91ea39b344260p-2,
+	0x1.8e3e1fcba6703p-2, 0x1.8a9693fdf061cp-2, 0x1.86f38a8accdf4p-2, 0x1.8354f7faa7fc5p-2,
+	0x1.7fbad11b949adp-2, 0x1.7c250aff48400p-2, 0x1.78939af92c0f3p-2, 0x1.7506769c81eafp-2,
+	0x1.717d93ba9cccdp-2, 0x1.6df8e8612b6ecp-2, 0x1.6a786ad894727p-2, 0x1.66fc11a2633afp-2,
+	0x1.6383d377c4babp-2, 0x1.600fa74813828p-2, 0x1.5c9f843772671p-2, 0x1.5933619d751bcp-2,
+	0x1.55cb3703d62d1p-2, 0x1.5266fc2539c94p-2, 0x1.4f06a8ebfcd13p-2, 0x1.4baa35710fafep-2,
+	0x1.485199fadc80dp-2, 0x1.44fccefc38117p-2, 0x1.41abcd135d515p-2, 0x1.3e5e8d08f2cbbp-2,
+	0x1.3b1507cf19c77p-2, 0x1.37cf368086b2cp-2, 0x1.348d125fa283fp-2, 0x1.314e94d5b4bbep-2,
+	0x1.2e13b77215be5p-2, 0x1.2adc73e96934ep-2, 0x1.27a8c414e0385p-2, 0x1.2478a1f182fe8p-2,
+	0x1.214c079f81cf7p-2, 0x1.1e22ef618d06bp-2, 0x1.1afd539c33ea1p-2, 0x1.17db2ed54a239p-2,
+	0x1.14bc7bb353ab8p-2, 0x1.11a134fcf6f75p-2, 0x1.0e8955987541ap-2, 0x1.0b74d88b28c36p-2,
+	0x1.0863b8f908b9bp-2, 0x1.0555f22433149p-2, 0x1.024b7f6c7baf9p-2, 0x1.fe88b89e01ed8p-3,
+	0x1.f88108cb8bb6bp-3, 0x1.f27fe6cea202ap-3, 0x1.ec854a4ca21c2p-3, 0x1.e6912b228c089p-3,
+	0x1.e0a381645f35fp-3, 0x1.dabc455c81015p-3, 0x1.d4db6f8b2cf92p-3, 0x1.cf00f8a5eec4bp-3,
+	0x1.c92cd99725a10p-3, 0x1.c35f0b7d91641p-3, 0x1.bd9787abe8fdep-3, 0x1.b7d647a87a72bp-3,
+	0x1.b21b452cd4505p-3, 0x1.ac667a2578a1bp-3, 0x1.a6b7e0b1996e0p-3, 0x1.a10f7322decf1p-3,
+	0x1.9b6d2bfd36b63p-3, 0x1.95d105f6ae788p-3, 0x1.903afbf756425p-3, 0x1.8aab09192e973p-3,
+	0x1.852128a8200b0p-3, 0x1.7f9d5621fd650p-3, 0x1.7a1f8d3690665p-3, 0x1.74a7c9c7b1751p-3,
+	0x1.6f3607e96a72fp-3, 0x1.69ca43e2250e8p-3, 0x1.64647a2ae4e9cp-3, 0x1.5f04a76f8df6fp-3,
+	0x1.59aac88f3775cp-3, 0x1.5456da9c8c09dp-3, 0x1.4f08dade376a4p-3, 0x1.49c0c6cf6238ep-3,
+	0x1.447e9c203c9b4p-3, 0x1.3f4258b698410p-3, 0x1.3a0bfaae928d4p-3, 0x1.34db805b4fafap-3,
+	0x1.2fb0e847c7863p-3, 0x1.2a8c3137a53a6p-3, 0x1.256d5a283a9d2p-3, 0x1.20546251885e5p-3,
+	0x1.1b4149275c58ap-3, 0x1.16340e5a87443p-3, 0x1.112cb1da2b434p-3, 0x1.0c2b33d524dd1p-3,
+	0x1.072f94bb9023dp-3, 0x1.0239d5406be88p-3, 0x1.fa93ecb6ba232p-4, 0x1.f0bff29528b67p-4,
+	0x1.e6f7bf29b1feap-4, 0x1.dd3b561776082p-4, 0x1.d38abb9be0731p-4, 0x1.c9e5f493be6bdp-4,
+	0x1.c04d0680b802cp-4, 0x1.b6bff78f34fb7p-4, 0x1.ad3ece9cb6128p-4, 0x1.a3c9933eacaf5p-4,
+	0x1.9a604dc9dc0fep-4, 0x1.9103075a50413p-4, 0x1.87b1c9dbf893ep-4, 0x1.7e6ca013f4e4dp-4,
+	0x1.753395aaa6d7fp-4, 0x1.6c06b7369a3e7p-4, 0x1.62e612485a445p-4, 0x1.59d1b5774bb6bp-4,
+	0x1.50c9b06fa7e17p-4, 0x1.47ce1401b7223p-4, 0x1.3edef2326e83cp-4, 0x1.35fc5e4d989d0p-4,
+	0x1.2d266cf9b7a28p-4, 0x1.245d344dd5460p-4, 0x1.1ba0cbe97ce08p-4, 0x1.12f14d0f259e6p-4,
+	0x1.0a4ed2c15d631p-4, 0x1.01b979e31226fp-4, 0x1.f262c2b6ce583p-5, 0x1.e16d547b2c47cp-5,
+	0x1.d092efeae600ap-5, 0x1.bfd3e0f289491p-5, 0x1.af3079038c597p-5, 0x1.9ea90f929b758p-5,
+	0x1.8e3e02a691375p-5, 0x1.7defb77af80c9p-5, 0x1.6dbe9b3992600p-5, 0x1.5dab23cf2ff69p-5,
+	0x1.4db5d0e1174f2p-5, 0x1.3ddf2ce993869p-5, 0x1.2e27ce83e3a4fp-5, 0x1.1e9059f1fac92p-5,
+	0x1.0f1982e96be0fp-5, 0x1.ff881d7191a2cp-6, 0x1.e121adb82f964p-6, 0x1.c301983cd6ea9p-6,
+	0x1.a529f4e234a42p-6, 0x1.879d1b6011823p-6, 0x1.6a5daf40c0f87p-6, 0x1.4d6eaf2fbf966p-6,
+	0x1.30d388daba032p-6, 0x1.1490334606b67p-6, 0x1.f152a4f734696p-7, 0x1.ba48d274febdcp-7,
+	0x1.841040d8df3cap-7, 0x1.4eb96421b129fp-7, 0x1.1a5922995660bp-7, 0x1.ce160f8ecbd47p-8,
+	0x1.69ea8d90cf658p-8, 0x1.08a1f03b0d9d6p-8, 0x1.55f9f43c1d644p-9, 0x1.4a605b6b9f70fp-10
+};
+
+void KDT_random4_init(kd_random4_t* rng4, const kd_random_t* rng)
+{
+	kd_random_t lane = *rng;
+	for (int l = 0; l < KDT_RANDOM_LANES; l++) {
+		for (int w = 0; w < 4; w++)
+			rng4->s[w][l] = lane.s[w];
+		KDT_random_jump(&lane);
+	}
+}
+
+// Um sorteio de cada sequência
+static inline void __KDT_random4_next(kd_random4_t* rng4, uint64_t* out)
+{
+	uint64_t (*s)[KDT_RANDOM_LANES] = rng4->s;
+	for (int l = 0; l < KDT_RANDOM_LANES; l++) {
+		out[l] = __KDT_random_rotl(s[0][l] + s[3][l], 23) + s[0][l];
+		const uint64_t t = s[1][l] << 17;
+
+		s[2][l] ^= s[0][l];
+		s[3][l] ^= s[1][l];
+		s[1][l] ^= s[2][l];
+		s[0][l] ^= s[3][l];
+		s[2][l] ^= t;
+		s[3][l] = __KDT_random_rotl(s[3][l], 45);
+	}
+}
+
+#ifdef KDT_X86_SIMD
+KDT_TARGET_AVX2
+static inline __m256i __KDT_rotl4(__m256i x, const int k)
+{
+	return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+}
+
+// O mesmo passo de __KDT_random4_next, com as quatro sequências num registro
+KDT_TARGET_AVX2
+static inline __m256i __KDT_random4_step(__m256i* s)
+{
+	const __m256i result = _mm256_add_epi64(__KDT_rotl4(_mm256_add_epi64(s[0], s[3]), 23), s[0]);
+	const __m256i t = _mm256_slli_epi64(s[1], 17);
+
+	s[2] = _mm256_xor_si256(s[2], s[0]);
+	s[3] = _mm256_xor_si256(s[3], s[1]);
+	s[1] = _mm256_xor_si256(s[1], s[2]);
+	s[0] = _mm256_xor_si256(s[0], s[3]);
+	s[2] = _mm256_xor_si256(s[2], t);
+	s[3] = __KDT_rotl4(s[3], 45);
+
+	return result;
+}
+
+// (x >> 11) * 2^-53 exato: os 53 bits viram double em duas metades, somando
+// números mágicos ao expoente (o AVX2 não converte inteiros de 64 bits)
+KDT_TARGET_AVX2
+static inline __m256d __KDT_to_uniform4(__m256i x)
+{
+	x = _mm256_srli_epi64(x, 11);
+	const __m256i lo = _mm256_or_si256(_mm256_and_si256(x, _mm256_set1_epi64x(0xFFFFFFFF)),
+	                                   _mm256_set1_epi64x(0x4330000000000000));
+	const __m256i hi = _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_set1_epi64x(0x4530000000000000));
+	const __m256d d = _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(hi), _mm256_set1_pd(0x1.0p84)),
+	                                _mm256_sub_pd(_mm256_castsi256_pd(lo), _mm256_set1_pd(0x1.0p52)));
+	return _mm256_mul_pd(d, _mm256_set1_pd(0x1.0p-53));
+}
+
+// Passos completos de KDT_random4_fill e KDT_random4_uniform com AVX2; devolvem
+// quantos valores escreveram
+KDT_TARGET_AVX2
+static size_t __KDT_random4_fill_avx2(kd_random4_t* rng4, uint64_t* out, const size_t n)
+{
+	size_t i = 0;
+	__m256i s[4];
+	for (int w = 0; w < 4; w++)
+		s[w] = _mm256_loadu_si256((const __m256i*) rng4->s[w]);
+	for (; i + KDT_RANDOM_LANES <= n; i += KDT_RANDOM_LANES)
+		_mm256_storeu_si256((__m256i*) (out + i), __KDT_random4_step(s));
+	for (int w = 0; w < 4; w++)
+		_mm256_storeu_si256((__m256i*) rng4->s[w], s[w]);
+	return i;
+}
+
+KDT_TARGET_AVX2
+static size_t __KDT_random4_uniform_avx2(kd_random4_t* rng4, double* out, const size_t n)
+{
+	size_t i = 0;
+	__m256i s[4];
+	for (int w = 0; w < 4; w++)
+		s[w] = _mm256_loadu_si256((const __m256i*) rng4->s[w]);
+	for (; i + KDT_RANDOM_LANES <= n; i += KDT_RANDOM_LANES)
+		_mm256_storeu_pd(out + i, __KDT_to_uniform4(__KDT_random4_step(s)));
+	for (int w = 0; w < 4; w++)
+		_mm256_storeu_si256((__m256i*) rng4->s[w], s[w]);
+	return i;
+}
+#endif
+
+void KDT_random4_fill(kd_random4_t* rng4, uint64_t* out, size_t n)
+{
+	size_t i = 0;
+
+#ifdef KDT_X86_SIMD
+	if (KDT_cpu_has_avx2())
+		i = __KDT_random4_fill_avx2(rng4, out, n);
+#endif
+	for (; i + KDT_RANDOM_LANES <= n; i += KDT_RANDOM_LANES)
+		__KDT_random4_next(rng4, out + i);
+
+	// Um último passo para a sobra; os sorteios que não cabem são descartados
+	if (i < n) {
+		uint64_t tail[KDT_RANDOM_LANES];
+		__KDT_random4_next(rng4, tail);
+		memcpy(out + i, tail, (n - i)*sizeof(uint64_t));
+	}
+}
+
+void KDT_random4_uniform(kd_random4_t* rng4, double* out, size_t n)
+{
+	size_t i = 0;
+
+#ifdef KDT_X86_SIMD
+	if (KDT_cpu_has_avx2())
+		i = __KDT_random4_uniform_avx2(rng4, out, n);
+#endif
+	for (; i + KDT_RANDOM_LANES <= n; i += KDT_RANDOM_LANES) {
+		uint64_t r[KDT_RANDOM_LANES];
+		__KDT_random4_next(rng4, r);
+		for (int l = 0; l < KDT_RANDOM_LANES; l++)
+			out[i + l] = (r[l] >> 11) * 0x1.0p-53;
+	}
+
+	if (i < n) {
+		uint64_t tail[KDT_RANDOM_LANES];
+		__KDT_random4_next(rng4, tail);
+		for (size_t l = 0; i + l < n; l++)
+			out[i + l] = (tail[l] >> 11) * 0x1.0p-53;
+	}
+}
+
+// Sorteios brutos consumidos um a um pela ziggurat
+typedef struct {
+	kd_random4_t* rng4;
+	size_t next;
+	uint64_t v[KDT_RANDOM_BUFFER];
+} kd_draws_t;
+
+static inline uint64_t __KDT_draw(kd_draws_t* d)
+{
+	if (d->next == KDT_RANDOM_BUFFER) {
+		KDT_random4_fill(d->rng4, d->v, KDT_RANDOM_BUFFER);
+		d->next = 0;
+	}
+	return d->v[d->next++];
+}
+
+static inline double __KDT_draw_uniform(kd_draws_t* d)
+{
+	return (__KDT_draw(d) >> 11) * 0x1.0p-53;
+}
+
+// Ziggurat: os 8 bits baixos escolhem a camada, o 9º o sinal e os 52 altos a
+// posição na camada. Quase sempre a amostra cai dentro da camada e sai direto;
+// senão, a cunha é testada contra a densidade e a camada 0 sorteia a cauda
+static inline double __KDT_ziggurat(kd_draws_t* d)
+{
+	while (1) {
+		const uint64_t r = __KDT_draw(d);
+		const int layer = r & 0xff;
+		const int negative = (r >> 8) & 1;
+		const uint64_t mantissa = r >> 12;
+		double x = mantissa * __KDT_zig_w[layer];
+
+		if (mantissa < __KDT_zig_k[layer])
+			return negative ? -x : x;
+
+		if (layer == 0) {
+			double xx, yy;
+			do {
+				xx = -log1p(-__KDT_draw_uniform(d)) / KDT_ZIGGURAT_R;
+				yy = -log1p(-__KDT_draw_uniform(d));
+			} while (yy + yy < xx*xx);
+			x = KDT_ZIGGURAT_R + xx;
+			return negative ? -x : x;
+		}
+
+		const double u = __KDT_draw_uniform(d);
+		if (__KDT_zig_f[layer] + u*(__KDT_zig_f[layer - 1] - __KDT_zig_f[layer]) < exp(-0.5*x*x))
+			return negative ? -x : x;
+	}
+}
+
+void KDT_random4_normal(kd_random4_t* rng4, double* out, size_t n)
+{
+	kd_draws_t d;
+	d.rng4 = rng4;
+	d.next = KDT_RANDOM_BUFFER;
+
+	for (size_t i = 0; i < n; i++)
+		out[i] = __KDT_ziggurat(&d);
+}
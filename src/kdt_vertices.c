@@ -19,173 +19,664 @@
                                                                             *
 Author: Rafael Vanali (email@user.com)                                      */
 
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <kdt_vertices.h>
+#include <kdt_partition.h>
+#include <kdt_random.h>
+#include <kdt_simd.h>
 
 #define MAX3_IDX(a,b,c) (((a) > (b))?(((a) > (c))?0:2):(((b) > (c))?1:2))
 #define MIN3_IDX(a,b,c) (((a) < (b))?(((a) < (c))?0:2):(((b) < (c))?1:2))
 
-// Função para criar uma fila vazia
-Queue* createQueue()
+// Tamanho mínimo padrão de uma subárvore construída numa tarefa separada
+#define KDT_DEFAULT_GRAIN_SIZE 16384
+
+// Tamanho mínimo padrão de uma fatia particionada por todas as threads
+#define KDT_DEFAULT_PARTITION_SIZE 1048576
+
+// Semente padrão dos geradores aleatórios da seleção
+#define KDT_DEFAULT_SEED 1234567890ULL
+
+// Fatias até este tamanho são ordenadas por inserção na seleção
+#define KDT_SELECT_CUTOFF 16
+
+// Fatias maiores que isto são reduzidas por passos de Floyd–Rivest
+#define KDT_FLOYD_RIVEST_SIZE 600
+
+// Modo multi-vias: tamanho mínimo de uma fatia, pontos da amostra por balde e
+// número máximo de níveis por distribuição
+#define KDT_MULTIWAY_SIZE 1048576
+#define KDT_MULTIWAY_SAMPLE 8192
+#define KDT_MULTIWAY_MAX_LEVELS 10
+#define KDT_MULTIWAY_LANES 8
+
+// BRIO: tamanho mínimo padrão da primeira rodada, número máximo de rodadas e
+// tamanho dos blocos que sorteiam as rodadas (um gerador por bloco)
+#define KDT_DEFAULT_FIRST_ROUND 1024
+#define KDT_MAX_ROUNDS 64
+#define KDT_ROUND_BLOCK 65536
+
+// Bits por eixo das chaves das curvas de preenchimento
+#define KDT_CURVE_BITS 21
+
+// Ponto médio deslizante: arestas da célula a menos desta fração da maior empatam
+#define KDT_SLIDING_TOLERANCE 1e-3
+
+// Cortes orientados: tamanho mínimo padrão de um nó cortado na direção principal e
+// iterações do método da potência
+#define KDT_DEFAULT_PCA_SIZE 1024
+#define KDT_PCA_ITERATIONS 32
+
+// Chaves compactas: subárvores de até tantos pontos são construídas numa cópia em
+// vertex_t, que cabe na cache; tamanho máximo da amostra de um passo de Floyd–Rivest
+// e pontos por bloco das estatísticas lidas pelos índices
+#define KDT_KEYS_LEAF_SIZE 65536
+#define KDT_KEYS_SAMPLE 4096
+#define KDT_KEYS_STATS_BLOCK 256
+
+void KDT_options_init(kd_options_t* options)
+{
+	options->num_threads = 0;
+	options->grain_size = KDT_DEFAULT_GRAIN_SIZE;
+	options->partition_size = KDT_DEFAULT_PARTITION_SIZE;
+	options->seed = KDT_DEFAULT_SEED;
+	options->multiway_levels = 0;
+	options->brio_ratio = 0.0;
+	options->brio_first_round = KDT_DEFAULT_FIRST_ROUND;
+	options->bfs_levels = -1;
+	options->bucket_size = 0;
+	options->subtree_order = KDT_PREORDER;
+	options->level_curve = KDT_CURVE_NONE;
+	options->split_policy = KDT_SPLIT_LONGEST_EDGE;
+	options->pca_size = KDT_DEFAULT_PCA_SIZE;
+	options->in_place = 0;
+	options->level_sync = 0;
+}
+
+// Resolve as opções passadas pelo usuário (NULL usa as opções padrão)
+static kd_options_t __KDT_options(const kd_options_t* options)
+{
+	kd_options_t opt;
+	if ( options != NULL )
+		opt = *options;
+	else
+		KDT_options_init(&opt);
+
+#ifdef _OPENMP
+	if ( opt.num_threads <= 0 )
+		opt.num_threads = omp_get_max_threads();
+#else
+	opt.num_threads = 1;
+#endif
+
+	if ( opt.grain_size == 0 )
+		opt.grain_size = KDT_DEFAULT_GRAIN_SIZE;
+
+	if ( opt.partition_size == 0 )
+		opt.partition_size = KDT_DEFAULT_PARTITION_SIZE;
+
+	if ( opt.brio_first_round == 0 )
+		opt.brio_first_round = KDT_DEFAULT_FIRST_ROUND;
+
+	if ( opt.pca_size == 0 )
+		opt.pca_size = KDT_DEFAULT_PCA_SIZE;
+
+	return opt;
+}
+
+// Número de postos calculados por vez antes de espalhar os pontos
+#define KDT_WALK_BLOCK 4096
+
+// Distância (em pontos) da pré-busca das posições de destino
+#define KDT_PREFETCH_DISTANCE 16
+
+// Nó visitado durante o percurso da árvore implícita
+typedef struct {
+	uint32_t lo;		// Início da fatia do nó no array
+	uint32_t n;			// Tamanho da fatia
+	uint32_t depth;		// Nível do nó
+	uint32_t index;		// Posição do nó no seu nível, contando os nós vazios
+} kd_walk_node_t;
+
+// Percurso em ordem (in-order) da árvore implícita. Como a árvore está em ordem no
+// array, o percurso visita as posições 0, 1, ..., n-1, uma após a outra.
+typedef struct {
+	kd_walk_node_t stack[33];
+	kd_walk_node_t current;
+	int top;
+	uint32_t n;			// Tamanho da árvore inteira
+} kd_walk_t;
+
+static void __KDT_walk_init(kd_walk_t* walk, const uint32_t n)
+{
+	kd_walk_node_t root = { 0, n, 0, 0 };
+	walk->current = root;
+	walk->top = 0;
+	walk->n = n;
+}
+
+// Posto na ordem em largura do nó (lo, depth, index) de uma árvore de n pontos. Todos
+// os níveis acima do último estão completos, então o nível d começa em 2^d - 1. Num
+// nível completo, o nó de índice i é o i-ésimo; no último nível (fatias de 0 ou 1
+// ponto), os nós não vazios antes dele são os pontos antes de lo, menos os i nós dos
+// níveis de cima que o percurso em ordem encontra antes da fatia.
+static inline uint32_t __KDT_bfs_rank(const uint32_t n, const uint32_t depth, const uint32_t lo, const uint32_t index)
+{
+	const uint64_t level_start = (UINT64_C(1) << depth) - 1;
+	if ( (uint64_t) n >= 2*level_start + 1 )
+		return level_start + index;
+
+	return level_start + lo - index;
+}
+
+static inline uint32_t __KDT_walk_rank(const kd_walk_t* walk, const kd_walk_node_t* node)
+{
+	return __KDT_bfs_rank(walk->n, node->depth, node->lo, node->index);
+}
+
+// Calcula os postos das próximas max posições do array (ou menos, no fim do percurso).
+// Retorna quantos postos foram calculados.
+static uint32_t __KDT_walk_next(kd_walk_t* walk, uint32_t* __restrict__ rank, const uint32_t max)
 {
-	Queue* queue = (Queue*)malloc(sizeof(Queue));
+	uint32_t count = 0;
 
-	// Tratar erro de alocação
-	if (queue == NULL)
-		exit(1);
+	while ( count < max )
+	{
+		// Desce pela esquerda até um nó vazio
+		while ( walk->current.n != 0 )
+		{
+			kd_walk_node_t left = { walk->current.lo, KDT_MEDIAN(walk->current.n),
+			                        walk->current.depth + 1, 2*walk->current.index };
+			walk->stack[walk->top++] = walk->current;
+			walk->current = left;
+		}
+
+		if ( walk->top == 0 )
+			break;
 
-	queue->front = NULL;
-	queue->rear = NULL;
-	return queue;
+		kd_walk_node_t node = walk->stack[--walk->top];
+		rank[count++] = __KDT_walk_rank(walk, &node);
+
+		kd_walk_node_t right = { node.lo + KDT_MEDIAN(node.n) + 1, node.n/2,
+		                         node.depth + 1, 2*node.index + 1 };
+		walk->current = right;
+	}
+
+	return count;
 }
 
-// Função para enfileirar um nó na fila
-void __enqueue(Queue* queue, kd_node_t* node)
+// Função para ordenar em largura a partir da árvore KD implícita. Os postos são
+// calculados em blocos e os pontos são lidos em sequência; a escrita em cada nível
+// também avança em sequência, o que mantém cerca de log2(n) fluxos de escrita.
+static status_t __KDT_vertices_breadth_first_sort( vertex_t* const __restrict__ array, kd_node_t raiz )
 {
-	queue_node_t* newNode = (queue_node_t*)malloc(sizeof(queue_node_t));
+	if ( KDT_node_is_empty(raiz) )
+		return HXT_STATUS_ERROR;
 
-	// Tratar erro de alocação
-	if ( newNode == NULL )
-		exit(1);
+	uint32_t rank[KDT_WALK_BLOCK];
+	const vertex_t* __restrict__ src = raiz.vertices;
 
-	newNode->node = node;
-	newNode->next = NULL;
+	kd_walk_t walk;
+	__KDT_walk_init(&walk, raiz.n);
 
-	if ( queue->rear == NULL )
+	uint32_t count;
+	while ( (count = __KDT_walk_next(&walk, rank, KDT_WALK_BLOCK)) != 0 )
 	{
-		queue->front = newNode;
-		queue->rear = newNode;
+		for (uint32_t j = 0; j < count; j++)
+		{
+			if ( j + KDT_PREFETCH_DISTANCE < count )
+				__builtin_prefetch(&array[rank[j + KDT_PREFETCH_DISTANCE]], 1);
+
+			array[rank[j]] = src[j];
+		}
+
+		src += count;
 	}
 
+	return HXT_STATUS_OK;
+}
+
+// Origem e destino da ordem de saída. Os emissores dão a posição de cada ponto na
+// fatia da árvore; o destino recebe o próprio ponto ou, no modo de índices, o índice
+// guardado em index para essa posição (chaves compactas) ou a própria posição.
+typedef struct {
+	vertex_t* vertices;		// NULL no modo de índices
+	uint32_t* order;
+	const vertex_t* tree;	// Pontos da fatia; NULL com chaves compactas
+	const uint32_t* index;	// Chaves compactas: índice do ponto de cada posição
+	const char* coord;		// Chaves compactas: coordenadas dos pontos, a cada stride bytes
+	size_t stride;
+} kd_sink_t;
+
+static inline void __KDT_sink_put(const kd_sink_t* sink, const uint64_t pos, const uint32_t src)
+{
+	if ( sink->vertices != NULL )
+		sink->vertices[pos] = sink->tree[src];
 	else
+		sink->order[pos] = sink->index != NULL ? sink->index[src] : src;
+}
+
+// Coordenadas do ponto da posição src da fatia
+static inline const double* __KDT_sink_coord(const kd_sink_t* sink, const uint32_t src)
+{
+	if ( sink->tree != NULL )
+		return sink->tree[src].coord;
+	return (const double*) (sink->coord + (size_t) sink->index[src]*sink->stride);
+}
+
+// Escreve em sink, na ordem em largura, os índices dos pontos da árvore KD implícita
+// de n pontos (ver __KDT_vertices_breadth_first_sort)
+static void __KDT_keys_breadth_first_order( const kd_sink_t* sink, const uint32_t n )
+{
+	uint32_t rank[KDT_WALK_BLOCK];
+	uint32_t src = 0;
+
+	kd_walk_t walk;
+	__KDT_walk_init(&walk, n);
+
+	uint32_t count;
+	while ( (count = __KDT_walk_next(&walk, rank, KDT_WALK_BLOCK)) != 0 )
 	{
-		queue->rear->next = newNode;
-		queue->rear = newNode;
+		for (uint32_t j = 0; j < count; j++)
+			__KDT_sink_put(sink, rank[j], src + j);
+
+		src += count;
 	}
 }
 
-// Função para desenfileirar um nó da fila
-kd_node_t* __dequeue(Queue* queue)
+// Ordem híbrida: os nós saem em largura enquanto estão acima de bfs_levels e têm
+// mais de bucket_size pontos. Um nó que não cumpre isso sai com a subárvore inteira
+// de uma vez, em profundidade ou em ordem, no lugar em que ele sairia na ordem em
+// largura. Assim os pontos consecutivos do fim da ordem ficam próximos no espaço.
+typedef struct {
+	uint32_t lo;		// Início da fatia do nó no array
+	uint32_t n;			// Tamanho da fatia
+	uint32_t depth;		// Nível do nó
+	uint32_t out;		// Posição de saída do ponto do nó, ou do primeiro ponto da subárvore
+	uint64_t key;		// Chave na curva do ponto do nó (só com level_curve)
+} kd_item_t;
+
+// A ordem por itens também é usada para reordenar os níveis ao longo de uma curva
+static inline int __KDT_hybrid_order(const kd_options_t* opt)
+{
+	return opt->bfs_levels >= 0 || opt->bucket_size > 1 || opt->level_curve != KDT_CURVE_NONE;
+}
+
+static inline int __KDT_is_bucket(const uint32_t n, const uint32_t depth, const kd_options_t* opt)
+{
+	return (opt->bfs_levels >= 0 && depth >= (uint32_t) opt->bfs_levels) || n <= opt->bucket_size;
+}
+
+// Número de itens da ordem híbrida (nós em largura + subárvores inteiras)
+static uint64_t __KDT_count_items(const uint32_t n, const uint32_t depth, const kd_options_t* opt)
+{
+	if ( n == 0 )
+		return 0;
+	if ( __KDT_is_bucket(n, depth, opt) )
+		return 1;
+	return 1 + __KDT_count_items(KDT_MEDIAN(n), depth + 1, opt) + __KDT_count_items(n/2, depth + 1, opt);
+}
+
+// Escreve a subárvore das posições [first, first + n) em profundidade (o ponto do
+// nó, depois a subárvore esquerda e a direita) a partir da posição out
+static void __KDT_sink_preorder(const kd_sink_t* sink, uint64_t out, const uint32_t first, const uint32_t n)
 {
-	if ( queue->front == NULL )
-		return NULL; // Fila vazia
+	uint32_t stack_lo[66], stack_n[66];
+	int top = 0;
 
-	queue_node_t* frontNode = queue->front;
-	kd_node_t* node = frontNode->node;
+	stack_lo[top] = first;
+	stack_n[top++] = n;
+	while ( top > 0 )
+	{
+		const uint32_t lo = stack_lo[--top];
+		const uint32_t m = stack_n[top];
+		if ( m == 0 )
+			continue;
 
-	queue->front = frontNode->next;
-	if ( queue->front == NULL )
-		queue->rear = NULL;
+		__KDT_sink_put(sink, out++, lo + KDT_MEDIAN(m));
 
-	free( frontNode );
+		stack_lo[top] = lo + KDT_MEDIAN(m) + 1;
+		stack_n[top++] = m/2;
+		stack_lo[top] = lo;
+		stack_n[top++] = KDT_MEDIAN(m);
+	}
+}
 
-	return node;
+// Espalha os 21 bits de x de 3 em 3 bits
+static inline uint64_t __KDT_spread_bits(uint64_t x)
+{
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffULL;
+	x = (x | x << 16) & 0x1f0000ff0000ffULL;
+	x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+	x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+	x = (x | x << 2)  & 0x1249249249249249ULL;
+	return x;
 }
 
-// Função para destruir a fila
-void __destroyQueue(Queue* queue)
+// Chave do ponto na curva de Morton ou de Hilbert dentro da caixa
+static uint64_t __KDT_curve_key(const double* coord, bbox_t bbox, kd_curve_t curve)
 {
-	while (queue->front != NULL)
+	const uint32_t max = (1u << KDT_CURVE_BITS) - 1;
+	uint32_t x[3];
+	for (int i = 0; i < 3; i++)
+	{
+		const double extent = bbox.max[i] - bbox.min[i];
+		const double t = extent > 0.0 ? (coord[i] - bbox.min[i])/extent*max : 0.0;
+		x[i] = t <= 0.0 ? 0 : t >= max ? max : (uint32_t) t;
+	}
+
+	// Hilbert: transformação de Skilling das coordenadas para a forma transposta
+	if ( curve == KDT_CURVE_HILBERT )
 	{
-		__dequeue(queue);
+		for (uint32_t q = 1u << (KDT_CURVE_BITS - 1); q > 1; q >>= 1)
+		{
+			const uint32_t p = q - 1;
+			for (int i = 0; i < 3; i++)
+			{
+				if ( x[i] & q )
+					x[0] ^= p;
+				else {
+					const uint32_t t = (x[0] ^ x[i]) & p;
+					x[0] ^= t;
+					x[i] ^= t;
+				}
+			}
+		}
+
+		x[1] ^= x[0];
+		x[2] ^= x[1];
+
+		uint32_t t = 0;
+		for (uint32_t q = 1u << (KDT_CURVE_BITS - 1); q > 1; q >>= 1)
+			if ( x[2] & q )
+				t ^= q - 1;
+		for (int i = 0; i < 3; i++)
+			x[i] ^= t;
 	}
 
-	free(queue);
+	return __KDT_spread_bits(x[0]) << 2 | __KDT_spread_bits(x[1]) << 1 | __KDT_spread_bits(x[2]);
 }
 
-// Função para ordenar em largura a partir da árvore KD diretamente no array
-static status_t __KDT_vertices_breadth_first_sort( vertex_t* const __restrict__ array, kd_node_t* raiz )
+static int __KDT_compare_items(const void* a, const void* b)
 {
-	if ( raiz == NULL )
-		return HXT_STATUS_ERROR;
+	const kd_item_t* ia = (const kd_item_t*) a;
+	const kd_item_t* ib = (const kd_item_t*) b;
+	if ( ia->key != ib->key )
+		return ia->key < ib->key ? -1 : 1;
+	return (ia->lo > ib->lo) - (ia->lo < ib->lo);
+}
+
+// Reordena os itens de cada nível pela chave do ponto do nó na curva. Os níveis
+// continuam saindo do mais grosso ao mais fino, mas o salto entre pontos
+// consecutivos de um nível fica curto.
+static void __KDT_curve_levels(kd_item_t* items, const uint64_t num_items, const kd_sink_t* sink, const uint32_t n,
+                               bbox_t bbox, const kd_options_t* opt)
+{
+	#pragma omp parallel for num_threads(opt->num_threads) if(n > opt->grain_size)
+	for (uint64_t i = 0; i < num_items; i++)
+	{
+		const double* coord = __KDT_sink_coord(sink, items[i].lo + KDT_MEDIAN(items[i].n));
+		items[i].key = __KDT_curve_key(coord, bbox, opt->level_curve);
+	}
+
+	for (uint64_t first = 0; first < num_items; )
+	{
+		uint64_t last = first + 1;
+		while ( last < num_items && items[last].depth == items[first].depth )
+			last++;
 
-	Queue* queue = createQueue();
-	__enqueue(queue, raiz);
+		qsort(items + first, last - first, sizeof(kd_item_t), __KDT_compare_items);
+		first = last;
+	}
+}
+
+// Escreve a árvore na ordem híbrida. A lista de itens em largura serve também de
+// fila; depois, cada item é copiado de forma independente.
+static status_t __KDT_hybrid_order_emit(const kd_sink_t* sink, const uint32_t n, bbox_t bbox, const kd_options_t* opt)
+{
+	const uint64_t num_items = __KDT_count_items(n, 0, opt);
+
+	kd_item_t* items = NULL;
+	HXT_CHECK( HXT_malloc(&items, num_items*sizeof(kd_item_t)) );
+
+	kd_item_t root = { 0, n, 0, 0, 0 };
+	items[0] = root;
+
+	uint64_t tail = 1;
+	for (uint64_t head = 0; head < tail; head++)
+	{
+		const kd_item_t item = items[head];
+		if ( __KDT_is_bucket(item.n, item.depth, opt) )
+			continue;
 
-	uint32_t index = 0;
+		kd_item_t left  = { item.lo, KDT_MEDIAN(item.n), item.depth + 1, 0, 0 };
+		kd_item_t right = { item.lo + KDT_MEDIAN(item.n) + 1, item.n/2, item.depth + 1, 0, 0 };
+		if ( left.n != 0 )
+			items[tail++] = left;
+		if ( right.n != 0 )
+			items[tail++] = right;
+	}
+	assert( tail == num_items );
+
+	if ( opt->level_curve != KDT_CURVE_NONE )
+		__KDT_curve_levels(items, num_items, sink, n, bbox, opt);
+
+	uint32_t out = 0;
+	for (uint64_t i = 0; i < num_items; i++)
+	{
+		items[i].out = out;
+		out += __KDT_is_bucket(items[i].n, items[i].depth, opt) ? items[i].n : 1;
+	}
+	assert( out == n );
 
-	while ( queue->front != NULL )
+	#pragma omp parallel for schedule(dynamic, 64) num_threads(opt->num_threads) if(n > opt->grain_size)
+	for (uint64_t i = 0; i < num_items; i++)
 	{
-		kd_node_t* currentNode = __dequeue(queue);
+		const kd_item_t item = items[i];
+
+		if ( !__KDT_is_bucket(item.n, item.depth, opt) )
+			__KDT_sink_put(sink, item.out, item.lo + KDT_MEDIAN(item.n));
+		else if ( opt->subtree_order == KDT_INORDER )
+		{
+			for (uint32_t j = 0; j < item.n; j++)
+				__KDT_sink_put(sink, item.out + j, item.lo + j);
+		}
+		else
+			__KDT_sink_preorder(sink, item.out, item.lo, item.n);
+	}
+
+	HXT_free(&items);
+	return HXT_STATUS_OK;
+}
 
-		// Enfileira os filhos do nó atual se existirem
-		if ( currentNode->esquerdo != NULL )
-			__enqueue(queue, currentNode->esquerdo);
+// Escreve a árvore de n pontos na ordem de saída: em largura ou, se pedido, híbrida
+static status_t __KDT_emit(const kd_sink_t* sink, const uint32_t n, bbox_t bbox, const kd_options_t* opt)
+{
+	if ( n == 0 )
+		return HXT_STATUS_OK;
 
-		if ( currentNode->direito != NULL )
-			__enqueue(queue, currentNode->direito);
+	if ( __KDT_hybrid_order(opt) )
+		return __KDT_hybrid_order_emit(sink, n, bbox, opt);
 
-		// Copia o elemento do nó atual para o array
-		array[index] = *(currentNode->vertex);
-		index++;
+	if ( sink->vertices != NULL ) {
+		kd_node_t raiz = { (vertex_t*) sink->tree, n };
+		return __KDT_vertices_breadth_first_sort(sink->vertices, raiz);
 	}
 
-	__destroyQueue(queue);
+	__KDT_keys_breadth_first_order(sink, n);
 	return HXT_STATUS_OK;
 }
 
-// Função para trocar dois vértices
-void __swapVertices( vertex_t *a, vertex_t *b )
+// Particiona v[0..n) em [<= pivot | > pivot] no eixo dado. Fatias grandes são
+// particionadas em blocos por todas as threads; com uma só thread, os mesmos blocos
+// rodam em sequência, para que o arranjo dos empates seja o mesmo.
+static uint64_t __KDT_partition(vertex_t* v, uint64_t n, int axis, double pivot, const kd_options_t* opt)
 {
-	double tmp[3];
-    memcpy(tmp,  a->coord, sizeof(tmp));
-    memcpy(a->coord, b->coord, sizeof(tmp));
-    memcpy(b->coord, tmp,  sizeof(tmp));
+	if ( n >= opt->partition_size )
+		return KDT_parallel_partition_le(v, n, axis, pivot);
+	return KDT_partition_le(v, n, axis, pivot);
 }
 
-// Função para selecionar um pivô aleatório e particionar os pontos
-int __partition(vertex_t* vertices, int left, int right, int axis)
+// Ordena v[left..right) por inserção (fatias pequenas)
+static void __KDT_insertion_sort(vertex_t* v, uint64_t left, uint64_t right, int axis)
 {
-	// Seleciona um pivô aleatório
-	int pivotIndex = left + rand() % (right - left + 1);
-	vertex_t pivot = vertices[pivotIndex];
+	for (uint64_t i = left + 1; i < right; i++) {
+		vertex_t x = v[i];
+		uint64_t j = i;
+		for (; j > left && v[j-1].coord[axis] > x.coord[axis]; j--)
+			v[j] = v[j-1];
+		v[j] = x;
+	}
+}
 
-	// Move o pivô para o final do array temporariamente
-	__swapVertices(&vertices[pivotIndex], &vertices[right]);
+static void __KDT_select(vertex_t* v, uint64_t n, uint64_t k, int axis, kd_random_t* rng, const kd_options_t* opt);
 
-	// Particiona os pontos em torno do pivô
-	int i = left - 1;
-	for (int j = left; j < right; j++)
-	{
-		if (vertices[j].coord[axis] <= pivot.coord[axis])
-		{
-			i++;
-			__swapVertices(&vertices[i], &vertices[j]);
-		}
+// Pivô de pior caso linear: mediana das medianas de grupos de 5 pontos. As medianas
+// dos grupos são movidas para o início da fatia e selecionadas recursivamente.
+static uint64_t __KDT_median_of_medians(vertex_t* v, uint64_t left, uint64_t right, int axis,
+                                        kd_random_t* rng, const kd_options_t* opt)
+{
+	uint64_t groups = 0;
+	for (uint64_t g = left; g + 5 <= right; g += 5) {
+		__KDT_insertion_sort(v, g, g + 5, axis);
+		__swapVertices(&v[left + groups], &v[g + 2]);
+		groups++;
+	}
+
+	__KDT_select(v + left, groups, groups/2, axis, rng, opt);
+	return left + groups/2;
+}
+
+// Passo de Floyd–Rivest: seleciona dois pivôs u <= w numa amostra aleatória de modo
+// que o k-ésimo ponto quase certamente fique entre eles, e restringe [left, right) à
+// faixa [u, w]. Devolve 1 se a faixa tem um único valor (a seleção terminou).
+static int __KDT_floyd_rivest_step(vertex_t* v, uint64_t* left, uint64_t* right, uint64_t k, int axis,
+                                   kd_random_t* rng, const kd_options_t* opt)
+{
+	const uint64_t size = *right - *left;
+	const double z  = log((double) size);
+	const double s  = 0.5*exp(2.0*z/3.0);
+	const double sd = 0.5*sqrt(z*s*(size - s)/size);
+	const uint64_t ns = (uint64_t) s;
+	const double ks = (double) (k - *left)*ns/size;
+
+	const uint64_t lo = ks - sd > 0 ? (uint64_t) (ks - sd) : 0;
+	const uint64_t hi = ks + sd < ns - 1 ? (uint64_t) (ks + sd) : ns - 1;
+
+	// Move uma amostra aleatória para o início da fatia (Fisher–Yates parcial)
+	vertex_t* sample = v + *left;
+	for (uint64_t i = 0; i < ns; i++)
+		__swapVertices(&sample[i], &sample[i + KDT_random_bounded(rng, size - i)]);
+
+	__KDT_select(sample, ns, hi, axis, rng, opt);
+	const double w = sample[hi].coord[axis];
+	if ( lo < hi )
+		__KDT_select(sample, hi, lo, axis, rng, opt);
+	const double u = sample[lo].coord[axis];
+
+	// [<= w | > w]
+	uint64_t count = __KDT_partition(v + *left, size, axis, w, opt);
+	if ( k >= *left + count ) {
+		*left += count;
+		return 0;
 	}
+	*right = *left + count;
 
-	__swapVertices(&vertices[i + 1], &vertices[right]); // Move o pivô de volta para a posição correta
+	// [< u | >= u]
+	count = __KDT_partition(v + *left, *right - *left, axis, nextafter(u, -INFINITY), opt);
+	if ( k < *left + count ) {
+		*right = *left + count;
+		return 0;
+	}
+	*left += count;
 
-	return i + 1;
+	return u == w;
 }
 
-// Função para encontrar a mediana dos pontos
-uint64_t __KDT_cut_along_axis(vertex_t* vertices, uint64_t n, int axis)
+// Partição de três vias (bandeira holandesa) de v[left..right) em torno de pivot:
+// [< pivot | == pivot | > pivot]. A primeira passada separa os pontos <= pivot; a
+// segunda, que separa os iguais, só percorre a parte <= e só é feita se k caiu nela
+// e houver indício de repetições (*fat, ou quase tudo <= pivot). Devolve 1 se k caiu
+// entre os iguais ao pivô (a seleção terminou); senão, restringe [left, right) ao
+// lado que contém k.
+static int __KDT_fat_partition(vertex_t* v, uint64_t* left, uint64_t* right, uint64_t k, int axis,
+                               double pivot, int* fat, const kd_options_t* opt)
+{
+	const uint64_t size = *right - *left;
+	const uint64_t le = __KDT_partition(v + *left, size, axis, pivot, opt);
+	if ( k >= *left + le ) {
+		*left += le;
+		return 0;
+	}
+
+	if ( !*fat && 4*le <= 3*size ) {
+		*right = *left + le;
+		return 0;
+	}
+
+	const uint64_t less = __KDT_partition(v + *left, le, axis, nextafter(pivot, -INFINITY), opt);
+	if ( le - less > 1 )
+		*fat = 1; // coordenadas repetidas: as próximas partições já separam os iguais
+	if ( k >= *left + less )
+		return 1;
+	*right = *left + less;
+	return 0;
+}
+
+// Seleção do k-ésimo ponto de v[0..n) ao longo de axis (introselect): ao final,
+// v[0..k) <= v[k] <= v[k+1..n). Fatias grandes usam passos de Floyd–Rivest, as
+// menores um pivô aleatório; se o orçamento de passos acaba, o pivô passa a ser a
+// mediana das medianas, o que limita o pior caso. Os pontos iguais ao pivô são
+// agrupados, de modo que coordenadas repetidas não degradam a seleção.
+static void __KDT_select(vertex_t* v, uint64_t n, uint64_t k, int axis, kd_random_t* rng, const kd_options_t* opt)
 {
 	uint64_t left  = 0;
-	uint64_t right = n - 1;
-	uint64_t k  = (n + n%2)/2;
-	uint64_t pivot_Index;
-
-	while (left < right) {
-		pivot_Index = __partition(vertices, left, right, axis);
-
-		uint64_t length = pivot_Index - left + 1;
-		if (length == k) {// A mediana foi encontrada
-			return pivot_Index;
-		} else if (k < length) // median is on the pivot's left
-			right = pivot_Index - 1;
-		else {
-			left = pivot_Index + 1;
-			k -= length;
+	uint64_t right = n;
+	int fat = 0;
+	int budget = 4;
+	for (uint64_t m = n; m > 1; m >>= 1)
+		budget += 2;
+
+	while ( right - left > KDT_SELECT_CUTOFF )
+	{
+		if ( budget > 0 && right - left > KDT_FLOYD_RIVEST_SIZE ) {
+			budget--;
+			if ( __KDT_floyd_rivest_step(v, &left, &right, k, axis, rng, opt) )
+				return;
+			continue;
+		}
+
+		uint64_t pivotIndex;
+		if ( budget > 0 ) {
+			budget--;
+			pivotIndex = left + KDT_random_bounded(rng, right - left);
 		}
+		else
+			pivotIndex = __KDT_median_of_medians(v, left, right, axis, rng, opt);
+
+		// O pivô fica do lado <=, logo cada passo descarta ao menos um ponto
+		if ( __KDT_fat_partition(v, &left, &right, k, axis, v[pivotIndex].coord[axis], &fat, opt) )
+			return;
 	}
 
-	if (left == right) {
-        return left;
-    }
+	__KDT_insertion_sort(v, left, right, axis);
+}
 
-    fprintf(stderr, "cut-longest-edge failed.\n");
-	return -1;
+// Função para encontrar a mediana dos pontos
+static uint64_t __KDT_cut_along_axis(vertex_t* vertices, uint64_t n, int axis, kd_random_t* rng, const kd_options_t* opt)
+{
+	const uint64_t k = KDT_MEDIAN(n);
+	__KDT_select(vertices, n, k, axis, rng, opt);
+	return k;
 }
 
 int __KDT_get_longest_axis(bbox_t bbox)
@@ -196,90 +687,1974 @@ int __KDT_get_longest_axis(bbox_t bbox)
     return MAX3_IDX(dx,dy,dz);
 }
 
-kd_node_t *__KDT_vertices_build_kdtree(bbox_t bbox, vertex_t* vertices, const uint32_t n)
+// Estatísticas dos pontos de um nó usadas pelas políticas de corte. As somas são
+// relativas a ref, para que a variância não perca precisão longe da origem.
+typedef struct {
+	bbox_t box;			// bbox justa dos pontos
+	double ref[3];
+	double sum[3];
+	double sum2[3];
+	double cross[3];	// somas dos produtos xy, xz e yz
+	uint64_t n;
+} kd_stats_t;
+
+// O que a política precisa das estatísticas de um nó de n pontos
+#define KDT_STATS_BOX 1
+#define KDT_STATS_MOMENTS 2
+#define KDT_STATS_COVARIANCE (KDT_STATS_MOMENTS | 4)
+
+static inline int __KDT_stats_needed(const uint64_t n, const kd_options_t* opt)
 {
-	if ( n == 0 )
-		return NULL;
+	switch ( opt->split_policy )
+	{
+		case KDT_SPLIT_LONGEST_EDGE:
+			return 0;
+		case KDT_SPLIT_MAX_VARIANCE:
+			return KDT_STATS_MOMENTS;
+		case KDT_SPLIT_PCA:
+			return n >= opt->pca_size ? KDT_STATS_COVARIANCE : KDT_STATS_BOX;
+		default:
+			return KDT_STATS_BOX;
+	}
+}
+
+static inline int __KDT_split_needs_stats(const kd_options_t* opt)
+{
+	return opt->split_policy != KDT_SPLIT_LONGEST_EDGE;
+}
 
-	// Determina a direção com maior variação
-	int axis = __KDT_get_longest_axis(bbox);
+static inline void __KDT_stats_init(kd_stats_t* stats, const double* ref)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		stats->box.min[i] = DBL_MAX;
+		stats->box.max[i] = -DBL_MAX;
+		stats->ref[i] = ref[i];
+		stats->sum[i] = 0.0;
+		stats->sum2[i] = 0.0;
+		stats->cross[i] = 0.0;
+	}
+	stats->n = 0;
+}
 
-    // Calcula a mediana usando o algoritmo de seleção de mediana
-	int median = __KDT_cut_along_axis(vertices, n, axis);
+// Acumula v[0..n) numa só passada. Chamada sempre com what constante, para que
+// cada caso seja compilado sem desvios no laço.
+static inline void __KDT_stats_add_what(kd_stats_t* stats, const vertex_t* v, const uint64_t n, const int what)
+{
+	kd_stats_t s = *stats;
 
-	// Cria o nó atual
-	kd_node_t *no = (kd_node_t*) malloc(sizeof(kd_node_t));
-	if (no == NULL)
+	for (uint64_t j = 0; j < n; j++)
 	{
-		fprintf(stderr, "Falha na alocação de memória\n");
-		exit(1);
+		double d[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const double x = v[j].coord[i];
+			if ( what & KDT_STATS_BOX ) {
+				s.box.min[i] = x < s.box.min[i] ? x : s.box.min[i];
+				s.box.max[i] = x > s.box.max[i] ? x : s.box.max[i];
+			}
+			d[i] = x - s.ref[i];
+			if ( what & KDT_STATS_MOMENTS ) {
+				s.sum[i] += d[i];
+				s.sum2[i] += d[i]*d[i];
+			}
+		}
+		if ( (what & KDT_STATS_COVARIANCE) == KDT_STATS_COVARIANCE ) {
+			s.cross[0] += d[0]*d[1];
+			s.cross[1] += d[0]*d[2];
+			s.cross[2] += d[1]*d[2];
+		}
 	}
 
-	no->vertex = &vertices[median];
+	s.n += n;
+	*stats = s;
+}
 
-	// Calcula os bounding boxes dos retangulos esquerdo e direito
-	bbox_t left_bbox  = bbox;
-	bbox_t right_bbox = bbox;
+static void __KDT_stats_add(kd_stats_t* stats, const vertex_t* v, const uint64_t n, const int what)
+{
+	switch ( what )
+	{
+		case KDT_STATS_BOX:
+			__KDT_stats_add_what(stats, v, n, KDT_STATS_BOX);
+			break;
+		case KDT_STATS_MOMENTS:
+			__KDT_stats_add_what(stats, v, n, KDT_STATS_MOMENTS);
+			break;
+		default:
+			__KDT_stats_add_what(stats, v, n, KDT_STATS_COVARIANCE);
+			break;
+	}
+}
 
-    left_bbox.max[axis]  = no->vertex->coord[axis];
-    right_bbox.min[axis] = no->vertex->coord[axis];
+static void __KDT_stats_merge(kd_stats_t* stats, const kd_stats_t* other)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		stats->box.min[i] = other->box.min[i] < stats->box.min[i] ? other->box.min[i] : stats->box.min[i];
+		stats->box.max[i] = other->box.max[i] > stats->box.max[i] ? other->box.max[i] : stats->box.max[i];
+		stats->sum[i] += other->sum[i];
+		stats->sum2[i] += other->sum2[i];
+		stats->cross[i] += other->cross[i];
+	}
+	stats->n += other->n;
+}
 
-	// Constrói de forma recursiva a subárvore esquerda
-	no->esquerdo = __KDT_vertices_build_kdtree(left_bbox, vertices, median);
+// Estatísticas de v[0..n). Fatias grandes são divididas em blocos entre as threads;
+// os blocos, e logo a ordem das somas, não dependem do número de threads.
+static void __KDT_stats(kd_stats_t* stats, const vertex_t* v, const uint64_t n, const double* ref,
+                        const kd_options_t* opt)
+{
+	const int what = __KDT_stats_needed(n, opt);
 
-	// Constrói de forma recursiva a subárvore direita
-	no->direito = __KDT_vertices_build_kdtree(right_bbox, vertices + median + 1, n - median - 1);
+	__KDT_stats_init(stats, ref);
+	if ( n < opt->partition_size ) {
+		__KDT_stats_add(stats, v, n, what);
+		return;
+	}
+
+	kd_stats_t part[KDT_MAX_PARTITION_TASKS];
+	const int num_tasks = KDT_partition_tasks(n);
+
+	#pragma omp taskloop default(none) shared(v, part) firstprivate(n, ref, what, num_tasks) num_tasks(num_tasks)
+	for (int t = 0; t < num_tasks; t++)
+	{
+		const uint64_t begin = n*t/num_tasks;
+		const uint64_t end = n*(t + 1)/num_tasks;
+		__KDT_stats_init(&part[t], ref);
+		__KDT_stats_add(&part[t], v + begin, end - begin, what);
+	}
+
+	for (int t = 0; t < num_tasks; t++)
+		__KDT_stats_merge(stats, &part[t]);
+}
 
-	return no;
+// Direção principal dos pontos (autovetor da maior variância da covariância),
+// pelo método da potência a partir do eixo de maior variância
+static void __KDT_principal_direction(const kd_stats_t* stats, double* dir)
+{
+	const double n = (double) stats->n;
+	double mean[3], c[3][3];
+	for (int i = 0; i < 3; i++)
+		mean[i] = stats->sum[i]/n;
+	for (int i = 0; i < 3; i++)
+		c[i][i] = stats->sum2[i]/n - mean[i]*mean[i];
+	c[0][1] = c[1][0] = stats->cross[0]/n - mean[0]*mean[1];
+	c[0][2] = c[2][0] = stats->cross[1]/n - mean[0]*mean[2];
+	c[1][2] = c[2][1] = stats->cross[2]/n - mean[1]*mean[2];
+
+	const int axis = MAX3_IDX(c[0][0], c[1][1], c[2][2]);
+	for (int i = 0; i < 3; i++)
+		dir[i] = i == axis;
+
+	for (int it = 0; it < KDT_PCA_ITERATIONS; it++)
+	{
+		double w[3];
+		for (int i = 0; i < 3; i++)
+			w[i] = c[i][0]*dir[0] + c[i][1]*dir[1] + c[i][2]*dir[2];
+
+		const double norm = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+		if ( !(norm > 0.0) )
+			return; // covariância nula: fica o eixo
+		for (int i = 0; i < 3; i++)
+			dir[i] = w[i]/norm;
+	}
 }
 
-kd_node_t *KDT_vertices_build_kdtree( bbox_t bbox, vertex_t* vertices, const uint32_t n)
+static inline double __KDT_project(const vertex_t* v, const double* dir)
 {
-	return __KDT_vertices_build_kdtree(bbox, vertices, n);
+	return v->coord[0]*dir[0] + v->coord[1]*dir[1] + v->coord[2]*dir[2];
 }
 
-// Função PRINCIPAL para ordenar o array de vertices usando a árvore KD
-static status_t KDT_vertices_sort( bbox_t bbox, vertex_t* const __restrict__ array, const uint32_t n )
+// Seleção sobre chaves compactas: key[i] é a chave e index[i] o ponto que ela
+// representa, 12 bytes por ponto. Usada pelos cortes orientados e por
+// KDT_vertices_order.
+static uint64_t __KDT_keys_partition(double* key, uint32_t* index, uint64_t n, double pivot, const kd_options_t* opt)
 {
-    kd_node_t* raiz = KDT_vertices_build_kdtree(bbox, array, n); // Construa a árvore KD
+	if ( n >= opt->partition_size )
+		return KDT_keys_parallel_partition_le(key, index, n, pivot);
+	return KDT_keys_partition_le(key, index, n, pivot);
+}
 
-    // Verifica se a árvore KD foi construída correntamente
-	if ( raiz == NULL )
-		return HXT_STATUS_ERROR;
+static void __KDT_keys_insertion_sort(double* key, uint32_t* index, const uint64_t left, const uint64_t right)
+{
+	for (uint64_t i = left + 1; i < right; i++) {
+		const double k = key[i];
+		const uint32_t x = index[i];
+		uint64_t j = i;
+		for (; j > left && key[j-1] > k; j--) {
+			key[j] = key[j-1];
+			index[j] = index[j-1];
+		}
+		key[j] = k;
+		index[j] = x;
+	}
+}
 
-    vertex_t* buffer = NULL;
-    HXT_CHECK(
-            HXT_malloc( &buffer, n*sizeof( vertex_t )));
+// Ordena key[left..right) por heapsort: o último recurso da seleção, O(n log n)
+static void __KDT_keys_heap_sort(double* key, uint32_t* index, const uint64_t left, const uint64_t right)
+{
+	double* k = key + left;
+	uint32_t* x = index + left;
+	const uint64_t n = right - left;
 
-    __KDT_vertices_breadth_first_sort(buffer, raiz);
+	for (uint64_t end = n, start = n/2; end > 1; )
+	{
+		uint64_t root;
+		if ( start > 0 )
+			root = --start;
+		else {
+			end--;
+			const double tk = k[0]; k[0] = k[end]; k[end] = tk;
+			const uint32_t tx = x[0]; x[0] = x[end]; x[end] = tx;
+			root = 0;
+		}
 
-    memcpy(array, buffer, n*sizeof(vertex_t));
+		for (uint64_t child; (child = 2*root + 1) < end; root = child)
+		{
+			if ( child + 1 < end && k[child + 1] > k[child] )
+				child++;
+			if ( !(k[child] > k[root]) )
+				break;
+			const double tk = k[root]; k[root] = k[child]; k[child] = tk;
+			const uint32_t tx = x[root]; x[root] = x[child]; x[child] = tx;
+		}
+	}
+}
 
-    HXT_free( &buffer );
-    return HXT_STATUS_OK;
+static int __KDT_compare_keys(const void* a, const void* b)
+{
+	const double x = *(const double*) a;
+	const double y = *(const double*) b;
+	return (x > y) - (x < y);
 }
 
-status_t KDT_vertices_BRIO( bbox_t bbox, vertex_t* vertices, const uint32_t n )
+// Pivôs de um passo de Floyd–Rivest (ver __KDT_floyd_rivest_step) sobre key[0..size):
+// a amostra é copiada e ordenada, sem mover as chaves, e dá u <= w com o k-ésimo
+// quase certamente entre eles
+static void __KDT_keys_pivots(const double* key, const uint64_t size, const uint64_t k, kd_random_t* rng,
+                              double* u, double* w)
 {
-	status_t sortStatus = KDT_vertices_sort( bbox, vertices, n );
-	if ( sortStatus != HXT_STATUS_OK )
-		return sortStatus;
+	const double z  = log((double) size);
+	double s = 0.5*exp(2.0*z/3.0);
+	if ( s > KDT_KEYS_SAMPLE )
+		s = KDT_KEYS_SAMPLE;
+	const double sd = 0.5*sqrt(z*s*(size - s)/size);
+	const uint64_t ns = (uint64_t) s;
+	const double ks = (double) k*ns/size;
 
-	return HXT_STATUS_OK;
+	const uint64_t lo = ks - sd > 0 ? (uint64_t) (ks - sd) : 0;
+	const uint64_t hi = ks + sd < ns - 1 ? (uint64_t) (ks + sd) : ns - 1;
+
+	double sample[KDT_KEYS_SAMPLE];
+	for (uint64_t i = 0; i < ns; i++)
+		sample[i] = key[KDT_random_bounded(rng, size)];
+	qsort(sample, ns, sizeof(double), __KDT_compare_keys);
+
+	*u = sample[lo];
+	*w = sample[hi];
+}
+
+// Seleção do k-ésimo de key[0..n), com index acompanhando as chaves: ao final,
+// key[0..k) <= key[k] <= key[k+1..n). Fatias grandes usam os pivôs de Floyd–Rivest,
+// as menores um pivô aleatório. Cada passo separa [<= w] e, dentro dele, [< u], de
+// modo que chaves repetidas terminam a seleção assim que k cai entre iguais. Se o
+// orçamento de passos acaba, o resto da fatia é ordenado por heapsort.
+static void __KDT_keys_select(double* key, uint32_t* index, const uint64_t n, const uint64_t k, kd_random_t* rng,
+                              const kd_options_t* opt)
+{
+	uint64_t left  = 0;
+	uint64_t right = n;
+	int budget = 4;
+	for (uint64_t m = n; m > 1; m >>= 1)
+		budget += 2;
+
+	while ( right - left > KDT_SELECT_CUTOFF )
+	{
+		const uint64_t size = right - left;
+		if ( budget-- <= 0 ) {
+			__KDT_keys_heap_sort(key, index, left, right);
+			return;
+		}
+
+		double u, w;
+		if ( size > KDT_FLOYD_RIVEST_SIZE )
+			__KDT_keys_pivots(key + left, size, k - left, rng, &u, &w);
+		else
+			u = w = key[left + KDT_random_bounded(rng, size)];
+
+		// [<= w | > w]: w está na fatia, logo a parte <= não é vazia
+		uint64_t count = __KDT_keys_partition(key + left, index + left, size, w, opt);
+		if ( k >= left + count ) {
+			left += count;
+			continue;
+		}
+		right = left + count;
+
+		// [< u | >= u]
+		count = __KDT_keys_partition(key + left, index + left, right - left, nextafter(u, -INFINITY), opt);
+		if ( k < left + count ) {
+			right = left + count;
+			continue;
+		}
+		left += count;
+
+		if ( u == w )
+			return; // [left, right) só tem chaves iguais a u
+	}
+
+	__KDT_keys_insertion_sort(key, index, left, right);
+}
+
+static void __KDT_permute_gather( vertex_t* vertices, const uint32_t n, uint32_t* order );
+
+// Coloca em v[k] o ponto de k-ésima menor projeção sobre dir, com os menores antes
+// e os maiores depois. Cada projeção é calculada uma só vez, numa chave compacta
+// (projeção + posição do ponto) selecionada como as chaves de KDT_vertices_order;
+// os pontos são depois reunidos na ordem selecionada, seguindo os ciclos da
+// permutação. Devolve 0, sem mexer nos pontos, se não há memória para as chaves.
+static int __KDT_select_along(vertex_t* v, const uint64_t n, const uint64_t k, const double* dir, kd_random_t* rng,
+                              const kd_options_t* opt)
+{
+	double* key = NULL;
+	uint32_t* index = NULL;
+	if ( HXT_malloc(&key, n*sizeof(double)) != HXT_STATUS_OK )
+		return 0;
+	if ( HXT_malloc(&index, n*sizeof(uint32_t)) != HXT_STATUS_OK ) {
+		HXT_free(&key);
+		return 0;
+	}
+
+	const int num_tasks = KDT_partition_tasks(n);
+	const int parallel = n >= opt->partition_size;
+
+	#pragma omp taskloop default(none) shared(v, key, index, dir) firstprivate(n) num_tasks(num_tasks) if(parallel)
+	for (uint64_t i = 0; i < n; i++)
+	{
+		key[i] = __KDT_project(&v[i], dir);
+		index[i] = (uint32_t) i;
+	}
+
+	__KDT_keys_select(key, index, n, k, rng, opt);
+	HXT_free(&key);
+
+	__KDT_permute_gather(v, (uint32_t) n, index);
+	HXT_free(&index);
+	return 1;
+}
+
+// Eixo de corte de um nó de célula cell segundo a política das opções. O ponto de
+// corte é sempre a mediana (a árvore implícita depende disso); a política só
+// escolhe o eixo.
+static int __KDT_split_axis(bbox_t cell, const kd_stats_t* stats, const kd_options_t* opt)
+{
+	switch ( opt->split_policy )
+	{
+		case KDT_SPLIT_TIGHT_BBOX:
+		case KDT_SPLIT_PCA:		// nós pequenos demais para a direção principal
+			return __KDT_get_longest_axis(stats->box);
+
+		case KDT_SPLIT_MAX_VARIANCE:
+		{
+			double var[3];
+			for (int i = 0; i < 3; i++)
+				var[i] = stats->sum2[i] - stats->sum[i]*stats->sum[i]/stats->n;
+			return MAX3_IDX(var[0], var[1], var[2]);
+		}
+
+		case KDT_SPLIT_SLIDING_MIDPOINT:
+		{
+			// Entre as arestas da célula quase tão longas quanto a maior, a de maior
+			// espalhamento dos pontos (regra do ponto médio deslizante)
+			double len[3], spread[3];
+			for (int i = 0; i < 3; i++) {
+				len[i] = cell.max[i] - cell.min[i];
+				spread[i] = stats->box.max[i] - stats->box.min[i];
+			}
+			const double max_len = len[MAX3_IDX(len[0], len[1], len[2])];
+
+			int axis = -1;
+			for (int i = 0; i < 3; i++)
+				if ( len[i] >= (1.0 - KDT_SLIDING_TOLERANCE)*max_len && (axis < 0 || spread[i] > spread[axis]) )
+					axis = i;
+			return axis;
+		}
+
+		default:
+			return __KDT_get_longest_axis(cell);
+	}
+}
+
+// Modo multi-vias: em vez de uma passada por nível, uma amostra define separadores
+// para os `levels` níveis do topo da árvore e todos os pontos são distribuídos nos
+// baldes correspondentes de uma só vez. Cada nó da amostra guarda uma faixa
+// [lo, hi] em volta da sua mediana; um ponto abaixo de lo (acima de hi) está, com
+// certeza, à esquerda (à direita) da mediana exata, desde que ela caia na faixa. Só
+// os pontos das faixas precisam ser examinados de novo para achar as medianas exatas.
+//
+// As classes são numeradas em ordem simétrica numa árvore completa de levels + 1
+// níveis: as folhas (pares) são os baldes e os nós internos (ímpares) são as faixas.
+// Essa é também a ordem em que os baldes aparecem na árvore exata.
+typedef struct {
+	int axis;
+	double lo, hi;
+} kd_splitter_t;
+
+typedef struct {
+	vertex_t* vertices;
+	uint16_t* cls;			// Classe de cada ponto; depois, balde de destino
+	kd_splitter_t* split;	// Separadores da amostra, por classe
+	uint64_t* first;		// first[c]: número de pontos de classe < c
+	uint64_t* band_first;	// band_first[c]: número de pontos das faixas de classe < c
+	vertex_t* band;			// Cópia dos pontos das faixas, agrupados por classe (dist = posição)
+	uint32_t* bucket;		// Balde de cada classe
+	uint64_t* size;			// Tamanho de cada balde na árvore exata
+	bbox_t* box;			// bbox de cada balde
+	kd_random_t* rng;
+	const kd_options_t* opt;
+} kd_multiway_t;
+
+static void __KDT_vertices_build_kdtree(bbox_t bbox, vertex_t* vertices, const uint32_t n, uint64_t seed,
+                                        const kd_stats_t* stats, const kd_options_t* opt);
+
+// Constrói os separadores sobre a amostra com a mesma regra da árvore exata (eixo
+// mais longo da célula, corte na mediana). A faixa cobre cerca de 5 desvios padrão
+// da posição da mediana na amostra.
+static void __KDT_multiway_sample(kd_splitter_t* split, uint32_t c, uint32_t h, bbox_t bbox,
+                                  vertex_t* sample, uint64_t s, kd_random_t* rng, const kd_options_t* opt)
+{
+	if ( h == 0 )
+		return;
+
+	const int axis = __KDT_get_longest_axis(bbox);
+	const uint64_t med = KDT_MEDIAN(s);
+	const uint64_t delta = (uint64_t) (2.5*sqrt((double) s)) + 1;
+
+	__KDT_select(sample, s, med, axis, rng, opt);
+	split[c].axis = axis;
+
+	split[c].lo = -INFINITY;
+	if ( med >= delta ) {
+		__KDT_select(sample, med, med - delta, axis, rng, opt);
+		split[c].lo = sample[med - delta].coord[axis];
+	}
+
+	split[c].hi = INFINITY;
+	if ( med + delta < s ) {
+		__KDT_select(sample + med + 1, s - med - 1, delta - 1, axis, rng, opt);
+		split[c].hi = sample[med + delta].coord[axis];
+	}
+
+	bbox_t left_bbox  = bbox;
+	bbox_t right_bbox = bbox;
+	left_bbox.max[axis]  = sample[med].coord[axis];
+	right_bbox.min[axis] = sample[med].coord[axis];
+
+	const uint32_t half = 1u << (h - 1);
+	__KDT_multiway_sample(split, c - half, h - 1, left_bbox, sample, med, rng, opt);
+	__KDT_multiway_sample(split, c + half, h - 1, right_bbox, sample + med + 1, s - med - 1, rng, opt);
+}
+
+// Classifica v[0..n) pelos separadores e conta os pontos de cada classe. Cada ponto
+// desce até uma folha ou até a primeira faixa que o contém; a descida de um ponto é
+// uma cadeia de dependências, então KDT_MULTIWAY_LANES pontos descem juntos.
+static void __KDT_multiway_classify(const vertex_t* v, uint64_t n, const kd_splitter_t* split, int levels,
+                                    uint16_t* cls, uint32_t* count)
+{
+	const int root = (1 << levels) - 1;
+
+	uint64_t i = 0;
+	for (; i + KDT_MULTIWAY_LANES <= n; i += KDT_MULTIWAY_LANES)
+	{
+		int c[KDT_MULTIWAY_LANES];
+		int active[KDT_MULTIWAY_LANES];
+		for (int j = 0; j < KDT_MULTIWAY_LANES; j++) {
+			c[j] = root;
+			active[j] = 1;
+		}
+
+		// Sem desvios: depois de cair numa faixa, o ponto para de descer
+		for (int h = (root + 1) >> 1; h > 0; h >>= 1)
+		{
+			for (int j = 0; j < KDT_MULTIWAY_LANES; j++)
+			{
+				const kd_splitter_t* s = &split[c[j]];
+				const double key = v[i + j].coord[s->axis];
+				const int dir = (key > s->hi) - (key < s->lo);
+				active[j] &= dir != 0;
+				c[j] += active[j]*dir*h;
+			}
+		}
+
+		for (int j = 0; j < KDT_MULTIWAY_LANES; j++) {
+			cls[i + j] = (uint16_t) c[j];
+			count[c[j]]++;
+		}
+	}
+
+	for (; i < n; i++)
+	{
+		int c = root;
+		for (int h = (root + 1) >> 1; h > 0; h >>= 1)
+		{
+			const double key = v[i].coord[split[c].axis];
+			const int dir = (key > split[c].hi) - (key < split[c].lo);
+			if ( dir == 0 )
+				break; // na faixa
+			c += dir*h;
+		}
+		cls[i] = (uint16_t) c;
+		count[c]++;
+	}
+}
+
+// Desce a árvore exata a partir do nó de classe c (altura h, n pontos, célula bbox).
+// Os candidatos a mediana são os pontos da faixa de c mais os pontos F[0..f) que as
+// faixas dos ancestrais mandaram para este lado. Todos os outros pontos da subárvore
+// já estão do lado certo, então basta selecionar a posição da mediana entre os
+// candidatos. Se o eixo exato difere do da amostra ou a mediana exata cai fora da
+// faixa, a subárvore inteira vira um único balde, construído da maneira usual.
+static void __KDT_multiway_resolve(kd_multiway_t* mw, uint32_t c, uint32_t h, uint64_t n, bbox_t bbox,
+                                   const vertex_t* F, uint64_t f)
+{
+	if ( h == 0 ) {
+		for (uint64_t j = 0; j < f; j++)
+			mw->cls[F[j].dist] = (uint16_t) c;
+		mw->size[c] = n;
+		mw->box[c] = bbox;
+		return;
+	}
+
+	const uint32_t span = (1u << h) - 1;
+	const uint64_t left = mw->first[c] - mw->first[c - span];
+	const uint64_t b = mw->band_first[c + 1] - mw->band_first[c];
+	const uint64_t w = f + b;
+	const uint64_t k = KDT_MEDIAN(n);
+	const int axis = __KDT_get_longest_axis(bbox);
+	assert( n == left + w + mw->first[c + span + 1] - mw->first[c + 1] );
+
+	vertex_t* W = NULL;
+	int ok = axis == mw->split[c].axis && k >= left && k - left < w
+	      && HXT_malloc(&W, w*sizeof(vertex_t)) == HXT_STATUS_OK;
+
+	if ( ok ) {
+		memcpy(W, F, f*sizeof(vertex_t));
+		memcpy(W + f, mw->band + mw->band_first[c], b*sizeof(vertex_t));
+		__KDT_select(W, w, k - left, axis, mw->rng, mw->opt);
+
+		const double median = W[k - left].coord[axis];
+		ok = median >= mw->split[c].lo && median <= mw->split[c].hi;
+	}
+
+	if ( !ok ) {
+		// A subárvore de c vira o balde c - span
+		for (uint32_t i = c - span; i <= c + span; i++)
+			mw->bucket[i] = c - span;
+		for (uint64_t j = 0; j < f; j++)
+			mw->cls[F[j].dist] = (uint16_t) (c - span);
+		mw->size[c - span] = n;
+		mw->box[c - span] = bbox;
+		HXT_free(&W);
+		return;
+	}
+
+	const uint64_t r = k - left;
+	mw->cls[W[r].dist] = (uint16_t) c;
+	mw->size[c] = 1;
+
+	bbox_t left_bbox  = bbox;
+	bbox_t right_bbox = bbox;
+	left_bbox.max[axis]  = W[r].coord[axis];
+	right_bbox.min[axis] = W[r].coord[axis];
+
+	const uint32_t half = 1u << (h - 1);
+	__KDT_multiway_resolve(mw, c - half, h - 1, k, left_bbox, W, r);
+	__KDT_multiway_resolve(mw, c + half, h - 1, n/2, right_bbox, W + r + 1, w - r - 1);
+
+	HXT_free(&W);
+}
+
+// Distribuição in-place (American flag): cada ponto vai direto para o próximo lugar
+// livre do seu balde. A classe acompanha o ponto.
+static void __KDT_multiway_distribute(vertex_t* v, uint16_t* cls, const uint32_t* bucket,
+                                      uint64_t* next, const uint64_t* end, uint32_t num_buckets)
+{
+	for (uint32_t b = 0; b < num_buckets; b++)
+	{
+		while ( next[b] < end[b] )
+		{
+			const uint64_t i = next[b];
+			vertex_t x = v[i];
+			uint16_t cx = cls[i];
+			uint32_t t = bucket[cx];
+
+			while ( t != b )
+			{
+				// Pula os pontos que já estão no balde de destino
+				while ( bucket[cls[next[t]]] == t )
+					next[t]++;
+				assert( next[t] < end[t] );
+
+				const uint64_t j = next[t]++;
+				vertex_t y = v[j];
+				uint16_t cy = cls[j];
+				v[j] = x;
+				cls[j] = cx;
+				x = y;
+				cx = cy;
+				t = bucket[cx];
+			}
+
+			v[i] = x;
+			cls[i] = cx;
+			next[b]++;
+		}
+	}
+}
+
+// Constrói os `levels` níveis do topo da árvore em poucas passadas: classificação,
+// seleção das medianas exatas só entre os pontos das faixas e uma distribuição. Os
+// baldes resultantes são construídos recursivamente. Devolve 0, sem alterar a
+// ordem dos pontos, se não há memória para as estruturas auxiliares.
+static int __KDT_multiway_build(bbox_t bbox, vertex_t* vertices, const uint32_t n, int levels,
+                                kd_random_t* rng, const kd_options_t* opt)
+{
+	const uint32_t num_classes = (2u << levels) - 1;
+	const uint32_t root = (1u << levels) - 1;
+	const uint64_t sample_size = (uint64_t) KDT_MULTIWAY_SAMPLE << levels;
+	const int num_tasks = opt->num_threads < KDT_MAX_PARTITION_TASKS ? opt->num_threads : KDT_MAX_PARTITION_TASKS;
+	int built = 0;
+
+	kd_multiway_t mw = { .vertices = vertices, .rng = rng, .opt = opt };
+	vertex_t* sample = NULL;
+	uint32_t* count = NULL;
+	uint64_t* next = NULL;
+
+	if ( HXT_malloc(&mw.cls, n*sizeof(uint16_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.split, num_classes*sizeof(kd_splitter_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.first, (num_classes + 1)*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.band_first, (num_classes + 1)*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.bucket, num_classes*sizeof(uint32_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.size, num_classes*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&mw.box, num_classes*sizeof(bbox_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&count, (uint64_t) num_tasks*num_classes*sizeof(uint32_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&next, 2*num_classes*sizeof(uint64_t)) != HXT_STATUS_OK
+	  || HXT_malloc(&sample, sample_size*sizeof(vertex_t)) != HXT_STATUS_OK )
+		goto cleanup;
+
+	// Separadores a partir de uma amostra aleatória (com reposição)
+	for (uint64_t i = 0; i < sample_size; i++)
+		sample[i] = vertices[KDT_random_bounded(rng, n)];
+	__KDT_multiway_sample(mw.split, root, levels, bbox, sample, sample_size, rng, opt);
+	HXT_free(&sample);
+
+	// Classificação de todos os pontos, em blocos com contagens separadas
+	memset(count, 0, (uint64_t) num_tasks*num_classes*sizeof(uint32_t));
+
+	#pragma omp taskloop default(none) shared(vertices, mw, count) firstprivate(n, levels, num_tasks, num_classes) num_tasks(num_tasks)
+	for (int t = 0; t < num_tasks; t++)
+	{
+		uint64_t begin = (uint64_t) n*t/num_tasks;
+		uint64_t end = (uint64_t) n*(t + 1)/num_tasks;
+		__KDT_multiway_classify(vertices + begin, end - begin, mw.split, levels, mw.cls + begin, count + (uint64_t) t*num_classes);
+	}
+
+	for (int t = 1; t < num_tasks; t++)
+		for (uint32_t c = 0; c < num_classes; c++)
+			count[c] += count[(uint64_t) t*num_classes + c];
+
+	mw.first[0] = 0;
+	mw.band_first[0] = 0;
+	for (uint32_t c = 0; c < num_classes; c++) {
+		mw.first[c + 1] = mw.first[c] + count[c];
+		mw.band_first[c + 1] = mw.band_first[c] + (c % 2 ? count[c] : 0);
+	}
+
+	// Copia os pontos das faixas, agrupados por classe. Com muitas coordenadas
+	// repetidas, as faixas concentram boa parte dos pontos e o modo não compensa.
+	const uint64_t num_band = mw.band_first[num_classes];
+	if ( num_band > n/4 || HXT_malloc(&mw.band, num_band*sizeof(vertex_t)) != HXT_STATUS_OK )
+		goto cleanup;
+
+	memcpy(next, mw.band_first, num_classes*sizeof(uint64_t));
+	for (uint64_t i = 0; i < n; i++) {
+		if ( mw.cls[i] % 2 ) {
+			vertex_t* p = &mw.band[next[mw.cls[i]]++];
+			*p = vertices[i];
+			p->dist = i;
+		}
+	}
+
+	// Medianas exatas e baldes da árvore exata
+	for (uint32_t c = 0; c < num_classes; c++) {
+		mw.bucket[c] = c;
+		mw.size[c] = 0;
+	}
+	__KDT_multiway_resolve(&mw, root, levels, n, bbox, NULL, 0);
+	HXT_free(&mw.band);
+
+	// Distribuição
+	uint64_t* end = next + num_classes;
+	uint64_t offset = 0;
+	for (uint32_t c = 0; c < num_classes; c++) {
+		next[c] = offset;
+		offset += mw.size[c];
+		end[c] = offset;
+	}
+	assert( offset == n );
+	__KDT_multiway_distribute(vertices, mw.cls, mw.bucket, next, end, num_classes);
+
+	// Constrói os baldes (as medianas já estão no lugar)
+	for (uint32_t c = 0; c < num_classes; c++)
+	{
+		if ( mw.size[c] <= 1 )
+			continue;
+
+		const bbox_t box = mw.box[c];
+		vertex_t* const slice = vertices + end[c] - mw.size[c];
+		const uint32_t size = (uint32_t) mw.size[c];
+		const uint64_t seed = KDT_random_next(rng);
+
+		#pragma omp task default(none) firstprivate(box, slice, size, seed, opt) if(size > opt->grain_size)
+		__KDT_vertices_build_kdtree(box, slice, size, seed, NULL, opt);
+	}
+	built = 1;
+
+cleanup:
+	HXT_free(&sample);
+	HXT_free(&mw.cls);
+	HXT_free(&mw.split);
+	HXT_free(&mw.first);
+	HXT_free(&mw.band_first);
+	HXT_free(&mw.band);
+	HXT_free(&mw.bucket);
+	HXT_free(&mw.size);
+	HXT_free(&mw.box);
+	HXT_free(&count);
+	HXT_free(&next);
+	return built;
+}
+
+// Corta um nó de n >= 2 pontos na mediana, segundo a política de corte, e devolve a
+// posição da mediana e as células dos filhos. stats só é usado pelas políticas que
+// olham os pontos.
+static uint32_t __KDT_split_node(bbox_t cell, vertex_t* vertices, const uint32_t n, const kd_stats_t* stats,
+                                 kd_random_t* rng, bbox_t* left_cell, bbox_t* right_cell, const kd_options_t* opt)
+{
+	*left_cell  = cell;
+	*right_cell = cell;
+
+	// Nós grandes no modo orientado cortam na direção principal dos seus pontos;
+	// a célula dos filhos não muda, já que o plano não é alinhado aos eixos
+	int axis;
+	if ( opt->split_policy == KDT_SPLIT_PCA && n >= opt->pca_size )
+	{
+		double dir[3];
+		__KDT_principal_direction(stats, dir);
+
+		if ( __KDT_select_along(vertices, n, KDT_MEDIAN(n), dir, rng, opt) )
+			return KDT_MEDIAN(n);
+
+		// Sem memória para as projeções: corta pela maior aresta da célula
+		axis = __KDT_get_longest_axis(cell);
+	}
+	else
+	{
+		// Determina a direção do corte
+		axis = __KDT_split_axis(cell, stats, opt);
+	}
+
+	// Calcula a mediana usando o algoritmo de seleção de mediana
+	const uint32_t median = __KDT_cut_along_axis(vertices, n, axis, rng, opt);
+	assert( median == KDT_MEDIAN(n) );
+
+	// Calcula os bounding boxes dos retangulos esquerdo e direito
+	left_cell->max[axis]  = vertices[median].coord[axis];
+	right_cell->min[axis] = vertices[median].coord[axis];
+	return median;
+}
+
+// Constrói a árvore KD implícita: a mediana de cada fatia fica em KDT_MEDIAN(n) e as
+// subárvores ocupam as fatias à sua esquerda e à sua direita. Nenhum nó é alocado.
+// As duas subárvores ocupam fatias disjuntas; acima de grain_size pontos, a esquerda
+// vira uma tarefa que qualquer thread ociosa pode roubar, enquanto a thread atual
+// segue com a direita. Cada nó tem seu próprio gerador, semeado pelo pai, de modo que
+// os sorteios não dependem de qual thread constrói cada subárvore.
+//
+// Com políticas de corte que olham os pontos, stats traz as estatísticas do nó,
+// calculadas pelo pai na mesma passada para os dois filhos (NULL: calcula aqui).
+static void __KDT_vertices_build_kdtree(bbox_t bbox, vertex_t* vertices, const uint32_t n, uint64_t seed,
+                                        const kd_stats_t* stats, const kd_options_t* opt)
+{
+	if ( n <= 1 )
+		return;
+
+	kd_random_t rng;
+	KDT_random_seed(&rng, seed);
+
+	// Fatias grandes constroem vários níveis por distribuição (a amostra não passa
+	// de 1/8 dos pontos). A amostra só sabe cortar pela maior aresta da célula.
+	if ( opt->multiway_levels > 1 && n >= KDT_MULTIWAY_SIZE && !__KDT_split_needs_stats(opt) )
+	{
+		int levels = opt->multiway_levels < KDT_MULTIWAY_MAX_LEVELS ? opt->multiway_levels : KDT_MULTIWAY_MAX_LEVELS;
+		while ( levels > 1 && ((uint64_t) KDT_MULTIWAY_SAMPLE << levels) > n/8 )
+			levels--;
+
+		if ( levels > 1 && __KDT_multiway_build(bbox, vertices, n, levels, &rng, opt) )
+			return;
+	}
+
+	kd_stats_t own_stats;
+	if ( stats == NULL && __KDT_split_needs_stats(opt) ) {
+		__KDT_stats(&own_stats, vertices, n, vertices[0].coord, opt);
+		stats = &own_stats;
+	}
+
+	bbox_t left_bbox, right_bbox;
+	const uint32_t median = __KDT_split_node(bbox, vertices, n, stats, &rng, &left_bbox, &right_bbox, opt);
+
+	// Estatísticas dos dois filhos numa só passada depois da seleção
+	kd_stats_t left_stats, right_stats;
+	if ( stats != NULL ) {
+		__KDT_stats(&left_stats, vertices, median, vertices[median].coord, opt);
+		__KDT_stats(&right_stats, vertices + median + 1, n - median - 1, vertices[median].coord, opt);
+	}
+	const int has_stats = stats != NULL;
+
+	// Sementes dos filhos
+	const uint64_t left_seed  = KDT_random_next(&rng);
+	const uint64_t right_seed = KDT_random_next(&rng);
+
+	// Constrói de forma recursiva a subárvore esquerda
+	#pragma omp task default(none) firstprivate(left_bbox, vertices, median, left_seed, left_stats, has_stats, opt) if(n > opt->grain_size)
+	__KDT_vertices_build_kdtree(left_bbox, vertices, median, left_seed, has_stats ? &left_stats : NULL, opt);
+
+	// Constrói de forma recursiva a subárvore direita
+	__KDT_vertices_build_kdtree(right_bbox, vertices + median + 1, n - median - 1, right_seed,
+	                            has_stats ? &right_stats : NULL, opt);
+}
+
+kd_node_t KDT_vertices_build_kdtree( bbox_t bbox, vertex_t* vertices, const uint32_t n, const kd_options_t* options)
+{
+	const kd_options_t opt = __KDT_options(options);
+
+	// As tarefas criadas pela recursão terminam na barreira ao fim da região paralela
+	#pragma omp parallel num_threads(opt.num_threads) if(n > opt.grain_size)
+	#pragma omp single
+	__KDT_vertices_build_kdtree(bbox, vertices, n, opt.seed, NULL, &opt);
+
+	kd_node_t raiz = { vertices, n };
+	return raiz;
+}
+
+// Limites nominais das rodadas do BRIO: a última rodada termina em n e cada rodada
+// termina brio_ratio vezes depois da anterior, até a primeira, que tem ao menos
+// brio_first_round pontos. Com brio_ratio <= 1 há uma única rodada.
+static int __KDT_brio_rounds(const uint32_t n, const kd_options_t* opt, uint32_t* begin)
+{
+	uint32_t end[KDT_MAX_ROUNDS];
+	int num_rounds = 0;
+
+	double bound = n;
+	end[num_rounds++] = n;
+	while ( opt->brio_ratio > 1.0 && num_rounds < KDT_MAX_ROUNDS && bound/opt->brio_ratio >= opt->brio_first_round )
+	{
+		bound /= opt->brio_ratio;
+		end[num_rounds++] = (uint32_t) bound;
+	}
+
+	begin[0] = 0;
+	for (int r = 0; r < num_rounds; r++)
+		begin[r + 1] = end[num_rounds - 1 - r];
+
+	return num_rounds;
+}
+
+// Sorteia, de forma independente, a rodada de cada ponto, com a probabilidade do
+// tamanho nominal da rodada, e devolve em pos[i] a posição do ponto i no array
+// dividido em rodadas. Cada bloco de KDT_ROUND_BLOCK pontos tem seu próprio
+// gerador, logo o resultado não depende do número de threads. Ao final, begin
+// contém os limites efetivos das rodadas.
+static status_t __KDT_brio_positions(const uint32_t n, const int num_rounds, uint32_t* begin, uint32_t* pos,
+                                     const kd_options_t* opt)
+{
+	const uint32_t num_blocks = (n + KDT_ROUND_BLOCK - 1)/KDT_ROUND_BLOCK;
+	double cumulative[KDT_MAX_ROUNDS];
+	for (int r = 0; r < num_rounds; r++)
+		cumulative[r] = (double) begin[r + 1]/n;
+
+	uint32_t* count = NULL;
+	HXT_CHECK( HXT_malloc(&count, (uint64_t) num_blocks*num_rounds*sizeof(uint32_t)) );
+	memset(count, 0, (uint64_t) num_blocks*num_rounds*sizeof(uint32_t));
+
+	// Sorteio: pos[i] guarda temporariamente a rodada do ponto i
+	#pragma omp parallel for num_threads(opt->num_threads) if(n > opt->grain_size)
+	for (uint32_t b = 0; b < num_blocks; b++)
+	{
+		kd_random_t rng;
+		KDT_random_seed(&rng, opt->seed ^ ((b + UINT64_C(1))*UINT64_C(0xD1B54A32D192ED03)));
+
+		uint32_t* block_count = count + (uint64_t) b*num_rounds;
+		const uint32_t end = b == num_blocks - 1 ? n : (b + 1)*KDT_ROUND_BLOCK;
+		for (uint32_t i = b*KDT_ROUND_BLOCK; i < end; i++)
+		{
+			// A maior parte dos pontos cai nas últimas rodadas
+			const double u = KDT_random_uniform(&rng);
+			int r = num_rounds - 1;
+			while ( r > 0 && u < cumulative[r - 1] )
+				r--;
+
+			pos[i] = r;
+			block_count[r]++;
+		}
+	}
+
+	// Limites efetivos das rodadas e primeira posição de cada bloco em cada rodada
+	uint32_t offset = 0;
+	for (int r = 0; r < num_rounds; r++)
+	{
+		begin[r] = offset;
+		for (uint32_t b = 0; b < num_blocks; b++)
+		{
+			const uint32_t c = count[(uint64_t) b*num_rounds + r];
+			count[(uint64_t) b*num_rounds + r] = offset;
+			offset += c;
+		}
+	}
+	begin[num_rounds] = offset;
+
+	#pragma omp parallel for num_threads(opt->num_threads) if(n > opt->grain_size)
+	for (uint32_t b = 0; b < num_blocks; b++)
+	{
+		uint32_t* next = count + (uint64_t) b*num_rounds;
+		const uint32_t end = b == num_blocks - 1 ? n : (b + 1)*KDT_ROUND_BLOCK;
+		for (uint32_t i = b*KDT_ROUND_BLOCK; i < end; i++)
+			pos[i] = next[pos[i]]++;
+	}
+
+	HXT_free(&count);
+	return HXT_STATUS_OK;
+}
+
+// Sementes das árvores das rodadas: com uma única rodada, a própria semente das opções
+static void __KDT_round_seeds(const int num_rounds, const kd_options_t* opt, uint64_t* seeds)
+{
+	kd_random_t rng;
+	KDT_random_seed(&rng, opt->seed);
+
+	for (int r = 0; r < num_rounds; r++)
+		seeds[r] = num_rounds > 1 ? KDT_random_next(&rng) : opt->seed;
+}
+
+// Constrói uma árvore por rodada, todas na mesma região paralela. Com uma única
+// rodada, equivale a KDT_vertices_build_kdtree.
+static void __KDT_vertices_build_rounds(bbox_t bbox, vertex_t* vertices, const uint32_t* begin, const int num_rounds,
+                                        const kd_options_t* opt)
+{
+	const uint32_t n = begin[num_rounds];
+
+	uint64_t seeds[KDT_MAX_ROUNDS];
+	__KDT_round_seeds(num_rounds, opt, seeds);
+
+	#pragma omp parallel num_threads(opt->num_threads) if(n > opt->grain_size)
+	#pragma omp single
+	for (int r = 0; r < num_rounds; r++)
+	{
+		vertex_t* const slice = vertices + begin[r];
+		const uint32_t size = begin[r + 1] - begin[r];
+		const uint64_t seed = seeds[r];
+
+		#pragma omp task default(none) firstprivate(bbox, slice, size, seed, opt) if(size > opt->grain_size)
+		__KDT_vertices_build_kdtree(bbox, slice, size, seed, NULL, opt);
+	}
+}
+
+// Motor em níveis: em vez de descer pela recursão, cada passada particiona todos os
+// nós de um nível (em paralelo entre os nós) e escreve as suas medianas direto nos
+// seus postos em largura. Não há árvore, fila nem segundo percurso, e ao fim da
+// passada do nível d os postos [0, 2^(d+1) - 1) da saída estão prontos. Os cortes, os
+// sorteios e as estatísticas são os da recursão, logo a árvore é a mesma (fora do
+// modo multi-vias, que o motor não usa).
+typedef struct {
+	bbox_t cell;
+	uint64_t seed;
+	uint32_t lo;		// Início da fatia do nó
+	uint32_t n;			// Tamanho da fatia (ao menos 2: nós menores saem pelo pai)
+	uint32_t index;		// Posição do nó no seu nível, contando os nós vazios
+	uint32_t ref;		// Ponto de referência das estatísticas: a mediana do pai
+} kd_level_node_t;
+
+typedef struct {
+	vertex_t* vertices;		// Pontos da árvore
+	uint32_t n;
+	uint32_t depth;			// Nível da próxima passada
+	kd_level_node_t* nodes;	// Nós desse nível com ao menos 2 pontos
+	uint64_t num_nodes;
+	kd_sink_t sink;
+} kd_levels_t;
+
+static inline int __KDT_levels_enabled(const kd_options_t* opt)
+{
+	return opt->level_sync && !__KDT_hybrid_order(opt);
+}
+
+static status_t __KDT_levels_init(kd_levels_t* levels, bbox_t bbox, kd_node_t raiz, const uint64_t seed,
+                                  const kd_sink_t* sink)
+{
+	levels->vertices = raiz.vertices;
+	levels->n = raiz.n;
+	levels->depth = 0;
+	levels->nodes = NULL;
+	levels->num_nodes = 0;
+	levels->sink = *sink;
+	levels->sink.tree = raiz.vertices;
+
+	if ( raiz.n == 1 )
+		__KDT_sink_put(&levels->sink, 0, 0);
+	if ( raiz.n < 2 )
+		return HXT_STATUS_OK;
+
+	HXT_CHECK( HXT_malloc(&levels->nodes, sizeof(kd_level_node_t)) );
+	kd_level_node_t root = { bbox, seed, 0, raiz.n, 0, 0 };
+	levels->nodes[0] = root;
+	levels->num_nodes = 1;
+	return HXT_STATUS_OK;
+}
+
+static void __KDT_levels_destroy(kd_levels_t* levels)
+{
+	HXT_free( &levels->nodes );
+	levels->num_nodes = 0;
+}
+
+// Filho de um nó do nível: com um só ponto, sai direto no seu posto; com dois ou mais,
+// entra no próximo nível
+static inline void __KDT_levels_child(const kd_levels_t* levels, kd_level_node_t* next, const kd_level_node_t* child)
+{
+	if ( child->n == 1 )
+		__KDT_sink_put(&levels->sink, __KDT_bfs_rank(levels->n, levels->depth + 1, child->lo, child->index),
+		               child->lo);
+	else if ( child->n > 1 )
+		*next = *child;
+}
+
+// Uma passada: corta todos os nós do nível atual e escreve as suas medianas
+static status_t __KDT_levels_step(kd_levels_t* levels, const kd_options_t* opt)
+{
+	const uint64_t num_nodes = levels->num_nodes;
+	if ( num_nodes == 0 )
+		return HXT_STATUS_OK;
+
+	// Posição no próximo nível dos filhos de cada nó: o tamanho dos filhos só depende
+	// do tamanho do nó
+	uint64_t* first = NULL;
+	HXT_CHECK( HXT_malloc(&first, (num_nodes + 1)*sizeof(uint64_t)) );
+	first[0] = 0;
+	for (uint64_t j = 0; j < num_nodes; j++)
+	{
+		const uint32_t n = levels->nodes[j].n;
+		first[j + 1] = first[j] + (KDT_MEDIAN(n) > 1) + (n/2 > 1);
+	}
+
+	kd_level_node_t* next = NULL;
+	if ( first[num_nodes] > 0 ) {
+		status_t status = HXT_malloc(&next, first[num_nodes]*sizeof(kd_level_node_t));
+		if ( status != HXT_STATUS_OK ) {
+			HXT_free( &first );
+			return status;
+		}
+	}
+
+	const kd_levels_t* const L = levels;
+	const int num_tasks = num_nodes < (uint64_t) 4*opt->num_threads ? (int) num_nodes : 4*opt->num_threads;
+	const uint64_t level_size = (uint64_t) L->nodes[0].n*num_nodes;
+
+	// Nós grandes dos primeiros níveis ainda são particionados por todas as threads
+	#pragma omp parallel num_threads(opt->num_threads) if(level_size > opt->grain_size)
+	#pragma omp single
+	#pragma omp taskloop default(none) shared(L, next, first) firstprivate(num_nodes, opt) num_tasks(num_tasks)
+	for (uint64_t j = 0; j < num_nodes; j++)
+	{
+		const kd_level_node_t node = L->nodes[j];
+		vertex_t* const v = L->vertices + node.lo;
+
+		kd_random_t rng;
+		KDT_random_seed(&rng, node.seed);
+
+		kd_stats_t stats;
+		const int has_stats = __KDT_split_needs_stats(opt);
+		if ( has_stats )
+			__KDT_stats(&stats, v, node.n, L->vertices[node.ref].coord, opt);
+
+		bbox_t left_cell, right_cell;
+		const uint32_t median = __KDT_split_node(node.cell, v, node.n, has_stats ? &stats : NULL, &rng,
+		                                         &left_cell, &right_cell, opt);
+		__KDT_sink_put(&L->sink, __KDT_bfs_rank(L->n, L->depth, node.lo, node.index), node.lo + median);
+
+		const uint64_t left_seed  = KDT_random_next(&rng);
+		const uint64_t right_seed = KDT_random_next(&rng);
+
+		kd_level_node_t left  = { left_cell, left_seed, node.lo, median, 2*node.index, node.lo + median };
+		kd_level_node_t right = { right_cell, right_seed, node.lo + median + 1, node.n - median - 1,
+		                          2*node.index + 1, node.lo + median };
+
+		uint64_t out = first[j];
+		__KDT_levels_child(L, &next[out], &left);
+		out += left.n > 1;
+		__KDT_levels_child(L, &next[out], &right);
+	}
+
+	HXT_free( &levels->nodes );
+	levels->nodes = next;
+	levels->num_nodes = first[num_nodes];
+	levels->depth++;
+
+	HXT_free( &first );
+	return HXT_STATUS_OK;
+}
+
+// Constrói a árvore de raiz e a escreve em sink, nível a nível
+static status_t __KDT_levels_build(bbox_t bbox, kd_node_t raiz, const uint64_t seed, const kd_sink_t* sink,
+                                   const kd_options_t* opt)
+{
+	kd_levels_t levels;
+	HXT_CHECK( __KDT_levels_init(&levels, bbox, raiz, seed, sink) );
+
+	status_t status = HXT_STATUS_OK;
+	while ( levels.num_nodes > 0 && status == HXT_STATUS_OK )
+		status = __KDT_levels_step(&levels, opt);
+
+	__KDT_levels_destroy(&levels);
+	return status;
+}
+
+// Constrói as árvores das rodadas e escreve a rodada r em sink a partir da posição
+// begin[r], pela recursão seguida da saída ou pelo motor em níveis
+static status_t __KDT_build_emit_rounds(bbox_t bbox, vertex_t* vertices, const uint32_t* begin, const int num_rounds,
+                                        const kd_sink_t* sink, const kd_options_t* opt)
+{
+	const int levels = __KDT_levels_enabled(opt);
+	if ( !levels )
+		__KDT_vertices_build_rounds(bbox, vertices, begin, num_rounds, opt);
+
+	uint64_t seeds[KDT_MAX_ROUNDS];
+	__KDT_round_seeds(num_rounds, opt, seeds);
+
+	status_t status = HXT_STATUS_OK;
+	for (int r = 0; r < num_rounds && status == HXT_STATUS_OK; r++)
+	{
+		kd_node_t raiz = { vertices + begin[r], begin[r + 1] - begin[r] };
+		kd_sink_t round = *sink;
+		round.tree = raiz.vertices;
+		round.vertices += begin[r];
+
+		if ( levels )
+			status = __KDT_levels_build(bbox, raiz, seeds[r], &round, opt);
+		else
+			status = __KDT_emit(&round, raiz.n, bbox, opt);
+	}
+
+	return status;
+}
+
+// vertices[i] recebe o antigo vertices[order[i]], seguindo os ciclos da permutação.
+// Cada posição pronta é marcada em order (order[i] = i), que é destruído.
+static void __KDT_permute_gather( vertex_t* vertices, const uint32_t n, uint32_t* order )
+{
+	for (uint32_t start = 0; start < n; start++)
+	{
+		if ( order[start] == start )
+			continue;
+
+		vertex_t tmp = vertices[start];
+		uint32_t i = start;
+		while ( order[i] != start )
+		{
+			const uint32_t next = order[i];
+			__builtin_prefetch(&vertices[order[next]]);
+			vertices[i] = vertices[next];
+			order[i] = i;
+			i = next;
+		}
+		vertices[i] = tmp;
+		order[i] = i;
+	}
+}
+
+// vertices[pos[i]] recebe o antigo vertices[i]: cada troca leva um ponto ao seu
+// lugar definitivo. pos é destruído.
+static void __KDT_permute_scatter( vertex_t* vertices, const uint32_t n, uint32_t* pos )
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		while ( pos[i] != i )
+		{
+			const uint32_t j = pos[i];
+			__swapVertices(&vertices[i], &vertices[j]);
+			pos[i] = pos[j];
+			pos[j] = j;
+		}
+	}
+}
+
+// Ordenação sem o buffer de n pontos: a ordem de saída de cada rodada sai como
+// índices de 4 bytes por ponto e é aplicada no próprio array. O mesmo vetor guarda
+// antes as posições das rodadas do BRIO.
+static status_t __KDT_vertices_sort_in_place( bbox_t bbox, vertex_t* array, const uint32_t n,
+                                              uint32_t* begin, const int num_rounds, const kd_options_t* opt )
+{
+	uint32_t* order = NULL;
+	HXT_CHECK( HXT_malloc(&order, n*sizeof(uint32_t)) );
+
+	status_t status = HXT_STATUS_OK;
+	if ( num_rounds > 1 )
+	{
+		status = __KDT_brio_positions(n, num_rounds, begin, order, opt);
+		if ( status == HXT_STATUS_OK )
+			__KDT_permute_scatter(array, n, order);
+	}
+
+	const int levels = __KDT_levels_enabled(opt);
+	if ( status == HXT_STATUS_OK && !levels )
+		__KDT_vertices_build_rounds(bbox, array, begin, num_rounds, opt);
+
+	uint64_t seeds[KDT_MAX_ROUNDS];
+	__KDT_round_seeds(num_rounds, opt, seeds);
+
+	for (int r = 0; r < num_rounds && status == HXT_STATUS_OK; r++)
+	{
+		kd_node_t raiz = { array + begin[r], begin[r + 1] - begin[r] };
+		kd_sink_t sink = { NULL, order, raiz.vertices, NULL, NULL, 0 };
+		if ( levels )
+			status = __KDT_levels_build(bbox, raiz, seeds[r], &sink, opt);
+		else
+			status = __KDT_emit(&sink, raiz.n, bbox, opt);
+		if ( status == HXT_STATUS_OK )
+			__KDT_permute_gather(raiz.vertices, raiz.n, order);
+	}
+
+	HXT_free(&order);
+	return status;
+}
+
+// Função PRINCIPAL para ordenar o array de vertices usando a árvore KD. No modo BRIO
+// (brio_ratio > 1), os pontos são primeiro sorteados em rodadas geométricas, e cada
+// rodada é ordenada pela sua própria árvore.
+static status_t KDT_vertices_sort( bbox_t bbox, vertex_t* const __restrict__ array, const uint32_t n, const kd_options_t* options )
+{
+	// Verifica se há pontos para construir a árvore KD
+	if ( n == 0 )
+		return HXT_STATUS_ERROR;
+
+	const kd_options_t opt = __KDT_options(options);
+
+	uint32_t begin[KDT_MAX_ROUNDS + 1];
+	const int num_rounds = __KDT_brio_rounds(n, &opt, begin);
+
+	if ( opt.in_place )
+		return __KDT_vertices_sort_in_place(bbox, array, n, begin, num_rounds, &opt);
+
+    vertex_t* buffer = NULL;
+    HXT_CHECK(
+            HXT_malloc( &buffer, n*sizeof( vertex_t )));
+
+	status_t status = HXT_STATUS_OK;
+	if ( num_rounds == 1 )
+	{
+		// Construa a árvore KD e a escreva no buffer
+		kd_sink_t sink = { buffer, NULL, NULL, NULL, NULL, 0 };
+		status = __KDT_build_emit_rounds(bbox, array, begin, num_rounds, &sink, &opt);
+
+		if ( status == HXT_STATUS_OK )
+			memcpy(array, buffer, n*sizeof(vertex_t));
+	}
+	else
+	{
+		// Distribui os pontos nas rodadas, constrói as árvores no buffer e as percorre
+		// de volta para o array
+		uint32_t* pos = NULL;
+		status = HXT_malloc(&pos, n*sizeof(uint32_t));
+		if ( status == HXT_STATUS_OK )
+			status = __KDT_brio_positions(n, num_rounds, begin, pos, &opt);
+		if ( status != HXT_STATUS_OK ) {
+			HXT_free( &pos );
+			HXT_free( &buffer );
+			return status;
+		}
+
+		#pragma omp parallel for num_threads(opt.num_threads) if(n > opt.grain_size)
+		for (uint32_t i = 0; i < n; i++)
+			buffer[pos[i]] = array[i];
+
+		HXT_free( &pos );
+
+		kd_sink_t sink = { array, NULL, NULL, NULL, NULL, 0 };
+		status = __KDT_build_emit_rounds(bbox, buffer, begin, num_rounds, &sink, &opt);
+	}
+
+    HXT_free( &buffer );
+    return status;
+}
+
+status_t KDT_vertices_BRIO( bbox_t bbox, vertex_t* vertices, const uint32_t n, const kd_options_t* options )
+{
+	status_t sortStatus = KDT_vertices_sort( bbox, vertices, n, options );
+	if ( sortStatus != HXT_STATUS_OK )
+		return sortStatus;
+
+	return HXT_STATUS_OK;
+}
+
+// data[i] recebe o antigo data[order[i]] (size bytes a cada stride) no próprio array,
+// seguindo os ciclos de order. Um bit por ponto marca as posições que já receberam
+// o seu elemento.
+static status_t __KDT_permute_cycles( char* data, const size_t stride, const size_t size, const uint32_t n,
+                                      const uint32_t* order )
+{
+	uint64_t* done = NULL;
+	char* tmp = NULL;
+	HXT_CHECK( HXT_malloc(&done, ((n + 63)/64)*sizeof(uint64_t)) );
+	status_t status = HXT_malloc(&tmp, size);
+	if ( status != HXT_STATUS_OK ) {
+		HXT_free( &done );
+		return status;
+	}
+	memset(done, 0, ((n + 63)/64)*sizeof(uint64_t));
+
+	for (uint32_t start = 0; start < n; start++)
+	{
+		if ( (done[start/64] >> (start%64)) & 1 )
+			continue;
+
+		memcpy(tmp, data + start*stride, size);
+		uint32_t i = start;
+		while (1)
+		{
+			done[i/64] |= UINT64_C(1) << (i%64);
+
+			const uint32_t next = order[i];
+			if ( next == start )
+				break;
+
+			memcpy(data + i*stride, data + next*stride, size);
+			i = next;
+		}
+		memcpy(data + i*stride, tmp, size);
+	}
+
+	HXT_free( &tmp );
+	HXT_free( &done );
+	return HXT_STATUS_OK;
+}
+
+// Como __KDT_permute_cycles, mas em geral os dados são reunidos num buffer por todas
+// as threads e copiados de volta; com in_place, segue os ciclos.
+static status_t __KDT_permute_bytes( char* data, const size_t stride, const size_t size, const uint32_t n,
+                                     const uint32_t* order, const kd_options_t* opt )
+{
+	if ( size == 0 || n == 0 )
+		return HXT_STATUS_OK;
+
+	if ( opt->in_place )
+		return __KDT_permute_cycles(data, stride, size, n, order);
+
+	char* buffer = NULL;
+	HXT_CHECK( HXT_malloc(&buffer, (size_t) n*size) );
+
+	#pragma omp parallel num_threads(opt->num_threads) if(n > opt->grain_size)
+	{
+		// Tamanhos comuns com cópias de tamanho fixo
+		if ( size == sizeof(uint32_t) ) {
+			#pragma omp for
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(buffer + i*sizeof(uint32_t), data + order[i]*stride, sizeof(uint32_t));
+		}
+		else if ( size == sizeof(uint64_t) ) {
+			#pragma omp for
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(buffer + i*sizeof(uint64_t), data + order[i]*stride, sizeof(uint64_t));
+		}
+		else {
+			#pragma omp for
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(buffer + i*size, data + order[i]*stride, size);
+		}
+
+		if ( stride == size ) {
+			#pragma omp for
+			for (uint32_t c = 0; c < (n + 65535)/65536; c++)
+			{
+				const size_t first = (size_t) c*65536;
+				const size_t count = n - first < 65536 ? n - first : 65536;
+				memcpy(data + first*size, buffer + first*size, count*size);
+			}
+		}
+		else {
+			#pragma omp for
+			for (uint32_t i = 0; i < n; i++)
+				memcpy(data + i*stride, buffer + i*size, size);
+		}
+	}
+
+	HXT_free( &buffer );
+	return HXT_STATUS_OK;
+}
+
+// Ordenação preguiçosa: o motor em níveis de uma rodada de cada vez, uma passada por
+// pedido. A saída própria cresce com os níveis pedidos.
+struct kd_stream {
+	bbox_t bbox;
+	vertex_t* vertices;
+	uint32_t n;
+	uint32_t begin[KDT_MAX_ROUNDS + 1];
+	uint64_t seeds[KDT_MAX_ROUNDS];
+	int num_rounds;
+	int round;				// Rodada atual
+	uint32_t depth;			// Próximo nível da rodada atual
+	uint32_t done;			// Pontos da saída prontos
+	kd_levels_t levels;		// Motor da rodada atual
+	vertex_t* output;
+	uint64_t capacity;		// Pontos alocados na saída
+	int own_output;
+	kd_options_t opt;
+};
+
+// Garante que a saída comporte size pontos
+static status_t __KDT_stream_reserve(kd_stream_t* stream, uint64_t size)
+{
+	if ( size <= stream->capacity )
+		return HXT_STATUS_OK;
+
+	if ( size < 2*stream->capacity )
+		size = 2*stream->capacity < stream->n ? 2*stream->capacity : stream->n;
+
+	vertex_t* output = NULL;
+	HXT_CHECK( HXT_malloc(&output, size*sizeof(vertex_t)) );
+	if ( stream->capacity > 0 )
+		memcpy(output, stream->output, stream->capacity*sizeof(vertex_t));
+	HXT_free( &stream->output );
+
+	stream->output = output;
+	stream->capacity = size;
+	stream->levels.sink.vertices = output + stream->begin[stream->round];
+	return HXT_STATUS_OK;
+}
+
+// A passada do nível d escreve pontos até o nível d + 1 (os filhos com um só ponto)
+static inline uint64_t __KDT_stream_needed(const kd_stream_t* stream)
+{
+	const uint32_t size = stream->begin[stream->round + 1] - stream->begin[stream->round];
+	const uint64_t end = (UINT64_C(4) << stream->depth) - 1;
+	return stream->begin[stream->round] + (end < size ? end : size);
+}
+
+static status_t __KDT_stream_start_round(kd_stream_t* stream)
+{
+	stream->depth = 0;
+	if ( stream->own_output )
+		HXT_CHECK( __KDT_stream_reserve(stream, __KDT_stream_needed(stream)) );
+
+	const int r = stream->round;
+	kd_node_t raiz = { stream->vertices + stream->begin[r], stream->begin[r + 1] - stream->begin[r] };
+	kd_sink_t sink = { stream->output + stream->begin[r], NULL, NULL, NULL, NULL, 0 };
+	return __KDT_levels_init(&stream->levels, stream->bbox, raiz, stream->seeds[r], &sink);
+}
+
+status_t KDT_stream_create( kd_stream_t** stream, bbox_t bbox, vertex_t* vertices, const uint32_t n,
+                            vertex_t* output, const kd_options_t* options )
+{
+	kd_stream_t* s = NULL;
+	HXT_CHECK( HXT_malloc(&s, sizeof(kd_stream_t)) );
+	memset(s, 0, sizeof(kd_stream_t));
+
+	s->bbox = bbox;
+	s->vertices = vertices;
+	s->n = n;
+	s->opt = __KDT_options(options);
+	s->num_rounds = __KDT_brio_rounds(n, &s->opt, s->begin);
+	__KDT_round_seeds(s->num_rounds, &s->opt, s->seeds);
+	s->output = output;
+	s->capacity = output != NULL ? n : 0;
+	s->own_output = output == NULL;
+	*stream = s;
+
+	// Os pontos vão para as suas rodadas já aqui: a distribuição não depende dos níveis
+	status_t status = HXT_STATUS_OK;
+	if ( s->num_rounds > 1 )
+	{
+		uint32_t* pos = NULL;
+		status = HXT_malloc(&pos, n*sizeof(uint32_t));
+		if ( status == HXT_STATUS_OK )
+			status = __KDT_brio_positions(n, s->num_rounds, s->begin, pos, &s->opt);
+		if ( status == HXT_STATUS_OK )
+			__KDT_permute_scatter(vertices, n, pos);
+		HXT_free( &pos );
+	}
+
+	if ( status == HXT_STATUS_OK && n > 0 )
+		status = __KDT_stream_start_round(s);
+
+	if ( status != HXT_STATUS_OK )
+		KDT_stream_destroy(stream);
+	return status;
+}
+
+status_t KDT_stream_next_level( kd_stream_t* stream, const vertex_t** level, uint32_t* count )
+{
+	*level = NULL;
+	*count = 0;
+
+	while ( stream->round < stream->num_rounds && stream->n > 0 )
+	{
+		const int r = stream->round;
+		const uint32_t size = stream->begin[r + 1] - stream->begin[r];
+		const uint64_t level_start = (UINT64_C(1) << stream->depth) - 1;
+
+		if ( level_start < size )
+		{
+			if ( stream->own_output )
+				HXT_CHECK( __KDT_stream_reserve(stream, __KDT_stream_needed(stream)) );
+
+			// Um nível só de folhas já saiu na passada anterior
+			if ( stream->levels.num_nodes > 0 )
+				HXT_CHECK( __KDT_levels_step(&stream->levels, &stream->opt) );
+
+			const uint64_t level_end = 2*level_start + 1 < size ? 2*level_start + 1 : size;
+			*level = stream->output + stream->begin[r] + level_start;
+			*count = level_end - level_start;
+			stream->done = stream->begin[r] + level_end;
+			stream->depth++;
+			return HXT_STATUS_OK;
+		}
+
+		__KDT_levels_destroy(&stream->levels);
+		if ( ++stream->round < stream->num_rounds )
+			HXT_CHECK( __KDT_stream_start_round(stream) );
+	}
+
+	return HXT_STATUS_OK;
+}
+
+uint32_t KDT_stream_done( const kd_stream_t* stream )
+{
+	return stream->done;
+}
+
+status_t KDT_stream_destroy( kd_stream_t** stream )
+{
+	if ( *stream == NULL )
+		return HXT_STATUS_OK;
+
+	__KDT_levels_destroy(&(*stream)->levels);
+	if ( (*stream)->own_output )
+		HXT_free( &(*stream)->output );
+	return HXT_free( stream );
+}
+
+// Modo de chaves compactas (KDT_vertices_order): a árvore é construída sobre dois
+// arrays, index (o índice de cada ponto) e key (a chave do corte do nó atual, lida
+// de novo das coordenadas do usuário em cada nó), 12 bytes por ponto em vez de um
+// vertex_t de 32. As seleções particionam só as chaves, sem gather. Subárvores de até
+// KDT_KEYS_LEAF_SIZE pontos cabem na cache e são construídas pela recursão comum numa
+// cópia em vertex_t, da qual os índices voltam pela ordem da árvore.
+typedef struct {
+	const char* coord;	// coord[0..2] do ponto i em coord + i*stride
+	size_t stride;
+	uint32_t* index;
+	double* key;
+} kd_keys_t;
+
+static inline const double* __KDT_keys_coord(const kd_keys_t* K, const uint32_t i)
+{
+	return (const double*) (K->coord + (size_t) i*K->stride);
+}
+
+// Acumula as estatísticas dos pontos de index[0..n), lidos em blocos para uma cópia
+// em vertex_t
+static void __KDT_keys_stats_add(kd_stats_t* stats, const kd_keys_t* K, const uint32_t* index, const uint64_t n,
+                                 const int what)
+{
+	vertex_t block[KDT_KEYS_STATS_BLOCK];
+	for (uint64_t first = 0; first < n; first += KDT_KEYS_STATS_BLOCK)
+	{
+		const uint64_t m = n - first < KDT_KEYS_STATS_BLOCK ? n - first : KDT_KEYS_STATS_BLOCK;
+		for (uint64_t j = 0; j < m; j++)
+			memcpy(block[j].coord, __KDT_keys_coord(K, index[first + j]), sizeof(block[j].coord));
+		__KDT_stats_add(stats, block, m, what);
+	}
+}
+
+// Estatísticas dos pontos de index[0..n) (ver __KDT_stats)
+static void __KDT_keys_stats(kd_stats_t* stats, const kd_keys_t* K, const uint32_t* index, const uint64_t n,
+                             const double* ref, const kd_options_t* opt)
+{
+	const int what = __KDT_stats_needed(n, opt);
+
+	__KDT_stats_init(stats, ref);
+	if ( n < opt->partition_size ) {
+		__KDT_keys_stats_add(stats, K, index, n, what);
+		return;
+	}
+
+	kd_stats_t part[KDT_MAX_PARTITION_TASKS];
+	const int num_tasks = KDT_partition_tasks(n);
+
+	#pragma omp taskloop default(none) shared(K, index, part) firstprivate(n, ref, what, num_tasks) num_tasks(num_tasks)
+	for (int t = 0; t < num_tasks; t++)
+	{
+		const uint64_t begin = n*t/num_tasks;
+		const uint64_t end = n*(t + 1)/num_tasks;
+		__KDT_stats_init(&part[t], ref);
+		__KDT_keys_stats_add(&part[t], K, index + begin, end - begin, what);
+	}
+
+	for (int t = 0; t < num_tasks; t++)
+		__KDT_stats_merge(stats, &part[t]);
+}
+
+// Chaves do corte de um nó: a coordenada axis ou, com axis < 0, a projeção sobre dir
+static void __KDT_keys_load(const kd_keys_t* K, const uint32_t lo, const uint32_t n, const int axis,
+                            const double* dir, const kd_options_t* opt)
+{
+	const int num_tasks = KDT_partition_tasks(n);
+	const int parallel = n >= opt->partition_size;
+
+	#pragma omp taskloop default(none) shared(K, dir) firstprivate(lo, n, axis) num_tasks(num_tasks) if(parallel)
+	for (uint32_t j = lo; j < lo + n; j++)
+	{
+		const double* c = __KDT_keys_coord(K, K->index[j]);
+		K->key[j] = axis >= 0 ? c[axis] : c[0]*dir[0] + c[1]*dir[1] + c[2]*dir[2];
+	}
+}
+
+// Constrói a subárvore das posições [lo, lo + n) numa cópia em vertex_t pela recursão
+// comum. Devolve 0, sem mexer em nada, se não há memória para a cópia.
+static int __KDT_keys_build_leaf(const kd_keys_t* K, bbox_t cell, const uint32_t lo, const uint32_t n,
+                                 const uint64_t seed, const kd_stats_t* stats, const kd_options_t* opt)
+{
+	vertex_t* v = NULL;
+	if ( HXT_malloc(&v, n*sizeof(vertex_t)) != HXT_STATUS_OK )
+		return 0;
+
+	for (uint32_t j = 0; j < n; j++) {
+		memcpy(v[j].coord, __KDT_keys_coord(K, K->index[lo + j]), sizeof(v[j].coord));
+		v[j].dist = K->index[lo + j];
+	}
+
+	// As tarefas da recursão usam a cópia, que só é liberada depois de todas
+	#pragma omp taskgroup
+	__KDT_vertices_build_kdtree(cell, v, n, seed, stats, opt);
+
+	for (uint32_t j = 0; j < n; j++)
+		K->index[lo + j] = (uint32_t) v[j].dist;
+
+	HXT_free(&v);
+	return 1;
+}
+
+// Mesma árvore de __KDT_vertices_build_kdtree (política de corte, sementes, tarefas
+// e estatísticas passadas pelo pai), construída sobre as chaves compactas. O modo
+// multi-vias não é usado.
+static void __KDT_keys_build_kdtree(const kd_keys_t* K, bbox_t cell, const uint32_t lo, const uint32_t n,
+                                    const uint64_t seed, const kd_stats_t* stats, const kd_options_t* opt)
+{
+	if ( n <= 1 )
+		return;
+
+	if ( n <= KDT_KEYS_LEAF_SIZE && __KDT_keys_build_leaf(K, cell, lo, n, seed, stats, opt) )
+		return;
+
+	kd_random_t rng;
+	KDT_random_seed(&rng, seed);
+
+	kd_stats_t own_stats;
+	if ( stats == NULL && __KDT_split_needs_stats(opt) ) {
+		__KDT_keys_stats(&own_stats, K, K->index + lo, n, __KDT_keys_coord(K, K->index[lo]), opt);
+		stats = &own_stats;
+	}
+
+	// Nós grandes no modo orientado cortam na direção principal (ver __KDT_split_node)
+	int axis = -1;
+	double dir[3];
+	if ( opt->split_policy == KDT_SPLIT_PCA && n >= opt->pca_size )
+		__KDT_principal_direction(stats, dir);
+	else
+		axis = __KDT_split_axis(cell, stats, opt);
+
+	__KDT_keys_load(K, lo, n, axis, dir, opt);
+
+	const uint32_t median = KDT_MEDIAN(n);
+	__KDT_keys_select(K->key + lo, K->index + lo, n, median, &rng, opt);
+
+	bbox_t left_cell = cell, right_cell = cell;
+	if ( axis >= 0 ) {
+		left_cell.max[axis]  = K->key[lo + median];
+		right_cell.min[axis] = K->key[lo + median];
+	}
+
+	kd_stats_t left_stats, right_stats;
+	const int has_stats = stats != NULL;
+	if ( has_stats ) {
+		const double* ref = __KDT_keys_coord(K, K->index[lo + median]);
+		__KDT_keys_stats(&left_stats, K, K->index + lo, median, ref, opt);
+		__KDT_keys_stats(&right_stats, K, K->index + lo + median + 1, n - median - 1, ref, opt);
+	}
+
+	const uint64_t left_seed  = KDT_random_next(&rng);
+	const uint64_t right_seed = KDT_random_next(&rng);
+
+	#pragma omp task default(none) firstprivate(K, left_cell, lo, median, left_seed, left_stats, has_stats, opt) if(n > opt->grain_size)
+	__KDT_keys_build_kdtree(K, left_cell, lo, median, left_seed, has_stats ? &left_stats : NULL, opt);
+
+	__KDT_keys_build_kdtree(K, right_cell, lo + median + 1, n - median - 1, right_seed,
+	                        has_stats ? &right_stats : NULL, opt);
+}
+
+// Bbox de vertices[first, last), a partir da caixa já acumulada em bbox
+static void __KDT_bbox_scalar( const vertex_t* vertices, uint64_t first, const uint64_t last, bbox_t* bbox )
+{
+	for (; first < last; first++)
+		for (int i = 0; i < 3; i++) {
+			const double c = vertices[first].coord[i];
+			bbox->min[i] = c < bbox->min[i] ? c : bbox->min[i];
+			bbox->max[i] = c > bbox->max[i] ? c : bbox->max[i];
+		}
+}
+
+#ifdef KDT_X86_SIMD
+// Com AVX2, cada vertex_t (32 bytes) é lido inteiro num registro: o quarto lane
+// (dist) é ignorado
+KDT_TARGET_AVX2
+static void __KDT_bbox_avx2( const vertex_t* vertices, uint64_t first, const uint64_t last, bbox_t* bbox )
+{
+	_Static_assert(sizeof(vertex_t) == 4*sizeof(double), "__KDT_bbox_avx2 lê um vertex_t por registro de 256 bits");
+	_Static_assert(offsetof(vertex_t, coord) == 0, "__KDT_bbox_avx2 espera coord no início de vertex_t");
+	__m256d mn0 = _mm256_set1_pd(DBL_MAX), mn1 = mn0;
+	__m256d mx0 = _mm256_set1_pd(-DBL_MAX), mx1 = mx0;
+	for (; first + 2 <= last; first += 2)
+	{
+		const __m256d a = _mm256_loadu_pd(vertices[first].coord);
+		const __m256d b = _mm256_loadu_pd(vertices[first + 1].coord);
+		mn0 = _mm256_min_pd(mn0, a);
+		mx0 = _mm256_max_pd(mx0, a);
+		mn1 = _mm256_min_pd(mn1, b);
+		mx1 = _mm256_max_pd(mx1, b);
+	}
+	double mn[4], mx[4];
+	_mm256_storeu_pd(mn, _mm256_min_pd(mn0, mn1));
+	_mm256_storeu_pd(mx, _mm256_max_pd(mx0, mx1));
+	for (int i = 0; i < 3; i++) {
+		bbox->min[i] = mn[i];
+		bbox->max[i] = mx[i];
+	}
+
+	__KDT_bbox_scalar(vertices, first, last, bbox);
+}
+#endif
+
+// Bbox de vertices[first, last), pelo caminho AVX2 se a CPU o tem
+static void __KDT_bbox_range( const vertex_t* vertices, const uint64_t first, const uint64_t last, bbox_t* bbox )
+{
+#ifdef KDT_X86_SIMD
+	if ( KDT_cpu_has_avx2() ) {
+		__KDT_bbox_avx2(vertices, first, last, bbox);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < 3; i++) {
+		bbox->min[i] = DBL_MAX;
+		bbox->max[i] = -DBL_MAX;
+	}
+	__KDT_bbox_scalar(vertices, first, last, bbox);
+}
+
+status_t KDT_vertices_bbox( const vertex_t* vertices, const uint32_t n, bbox_t* bbox, const kd_options_t* options )
+{
+	const kd_options_t opt = __KDT_options(options);
+
+	for (int i = 0; i < 3; i++) {
+		bbox->min[i] = DBL_MAX;
+		bbox->max[i] = -DBL_MAX;
+	}
+
+	// Cada thread reduz uma faixa contígua; min e max dão o mesmo resultado em
+	// qualquer ordem de junção
+	#pragma omp parallel num_threads(opt.num_threads) if(n > opt.grain_size)
+	{
+		int nthreads = 1, thread = 0;
+#ifdef _OPENMP
+		nthreads = omp_get_num_threads();
+		thread = omp_get_thread_num();
+#endif
+		bbox_t partial;
+		__KDT_bbox_range(vertices, (uint64_t) n*thread/nthreads, (uint64_t) n*(thread + 1)/nthreads, &partial);
+
+		#pragma omp critical
+		for (int i = 0; i < 3; i++) {
+			bbox->min[i] = partial.min[i] < bbox->min[i] ? partial.min[i] : bbox->min[i];
+			bbox->max[i] = partial.max[i] > bbox->max[i] ? partial.max[i] : bbox->max[i];
+		}
+	}
+
+	return HXT_STATUS_OK;
+}
+
+double KDT_vertices_mean_distance( const vertex_t* vertices, const uint32_t n )
+{
+	if ( n < 2 )
+		return 0.0;
+
+	double sum = 0.0;
+	#pragma omp parallel for reduction(+:sum)
+	for (uint32_t i = 1; i < n; i++)
+	{
+		const double dx = vertices[i].coord[0] - vertices[i - 1].coord[0];
+		const double dy = vertices[i].coord[1] - vertices[i - 1].coord[1];
+		const double dz = vertices[i].coord[2] - vertices[i - 1].coord[2];
+		sum += sqrt(dx*dx + dy*dy + dz*dz);
+	}
+
+	return sum/(n - 1);
+}
+
+// Constrói a árvore de cada rodada sobre as chaves compactas e a escreve em order.
+// O próprio order guarda antes as posições das rodadas do BRIO.
+status_t KDT_vertices_order( bbox_t bbox, const double* coord, const size_t stride, const uint32_t n,
+                             uint32_t* order, const kd_options_t* options )
+{
+	if ( n == 0 )
+		return HXT_STATUS_OK;
+
+	const kd_options_t opt = __KDT_options(options);
+
+	uint32_t begin[KDT_MAX_ROUNDS + 1];
+	const int num_rounds = __KDT_brio_rounds(n, &opt, begin);
+
+	kd_keys_t K = { (const char*) coord, stride, NULL, NULL };
+	HXT_CHECK( HXT_malloc(&K.index, n*sizeof(uint32_t)) );
+
+	status_t status = HXT_malloc(&K.key, n*sizeof(double));
+	if ( status == HXT_STATUS_OK && num_rounds > 1 )
+		status = __KDT_brio_positions(n, num_rounds, begin, order, &opt);
+	if ( status != HXT_STATUS_OK ) {
+		HXT_free( &K.key );
+		HXT_free( &K.index );
+		return status;
+	}
+
+	uint64_t seeds[KDT_MAX_ROUNDS];
+	__KDT_round_seeds(num_rounds, &opt, seeds);
+
+	const kd_keys_t* const keys = &K;
+	const kd_options_t* const o = &opt;
+
+	#pragma omp parallel num_threads(opt.num_threads) if(n > opt.grain_size)
+	{
+		#pragma omp for
+		for (uint32_t i = 0; i < n; i++)
+			K.index[num_rounds > 1 ? order[i] : i] = i;
+
+		#pragma omp single
+		for (int r = 0; r < num_rounds; r++)
+		{
+			const uint32_t first = begin[r];
+			const uint32_t size = begin[r + 1] - begin[r];
+			const uint64_t seed = seeds[r];
+
+			#pragma omp task default(none) firstprivate(keys, bbox, first, size, seed, o) if(size > o->grain_size)
+			__KDT_keys_build_kdtree(keys, bbox, first, size, seed, NULL, o);
+		}
+	}
+
+	HXT_free( &K.key );
+
+	for (int r = 0; r < num_rounds && status == HXT_STATUS_OK; r++)
+	{
+		kd_sink_t sink = { NULL, order + begin[r], NULL, K.index + begin[r], K.coord, stride };
+		status = __KDT_emit(&sink, begin[r + 1] - begin[r], bbox, &opt);
+	}
+
+	HXT_free( &K.index );
+	return status;
+}
+
+// Os pontos são ordenados por KDT_vertices_sort (respeitando in_place e level_sync)
+// com o índice original em dist; a ordem é lida de volta de dist, que então recebe o
+// valor original, e é aplicada a cada array de atributos.
+status_t KDT_vertices_BRIO_attributes( bbox_t bbox, vertex_t* vertices, const uint32_t n,
+                                       const kd_attribute_t* attributes, const int num_attributes,
+                                       uint32_t* order, uint32_t* inverse, const kd_options_t* options )
+{
+	for (int a = 0; a < num_attributes; a++)
+		if ( attributes[a].size > attributes[a].stride || (attributes[a].data == NULL && attributes[a].size > 0) )
+			return HXT_ERROR_MSG(HXT_STATUS_FAILED, "invalid attribute array %d (size %lu, stride %lu)", a,
+			                     (unsigned long) attributes[a].size, (unsigned long) attributes[a].stride);
+
+	if ( n == 0 )
+		return HXT_STATUS_OK;
+
+	const kd_options_t opt = __KDT_options(options);
+
+	uint64_t* dist = NULL;
+	HXT_CHECK( HXT_malloc(&dist, n*sizeof(uint64_t)) );
+
+	uint32_t* perm = order;
+	status_t status = HXT_STATUS_OK;
+	if ( perm == NULL )
+		status = HXT_malloc(&perm, n*sizeof(uint32_t));
+	if ( status != HXT_STATUS_OK ) {
+		HXT_free( &dist );
+		return status;
+	}
+
+	#pragma omp parallel for num_threads(opt.num_threads) if(n > opt.grain_size)
+	for (uint32_t i = 0; i < n; i++) {
+		dist[i] = vertices[i].dist;
+		vertices[i].dist = i;
+	}
+
+	status = KDT_vertices_sort(bbox, vertices, n, &opt);
+
+	#pragma omp parallel for num_threads(opt.num_threads) if(n > opt.grain_size)
+	for (uint32_t i = 0; i < n; i++) {
+		perm[i] = (uint32_t) vertices[i].dist;
+		vertices[i].dist = dist[perm[i]];
+	}
+	HXT_free( &dist );
+
+	for (int a = 0; a < num_attributes && status == HXT_STATUS_OK; a++)
+		status = __KDT_permute_bytes(attributes[a].data, attributes[a].stride, attributes[a].size, n, perm, &opt);
+
+	if ( status == HXT_STATUS_OK && inverse != NULL )
+	{
+		#pragma omp parallel for num_threads(opt.num_threads) if(n > opt.grain_size)
+		for (uint32_t i = 0; i < n; i++)
+			inverse[perm[i]] = i;
+	}
+
+	if ( perm != order )
+		HXT_free( &perm );
+	return status;
+}
+
+// Aplica a permutação no próprio array, seguindo os ciclos de order.
+status_t KDT_vertices_permute( vertex_t* vertices, const uint32_t n, const uint32_t* order )
+{
+	return __KDT_permute_cycles((char*) vertices, sizeof(vertex_t), sizeof(vertex_t), n, order);
 }
 
-void __desenha_arvore_recursivo(kd_node_t *v, FILE *fptr) {
-    if (v == NULL) {
+void __desenha_arvore_recursivo(kd_node_t v, FILE *fptr) {
+    if (KDT_node_is_empty(v)) {
         fprintf(fptr, "[null,phantom]");
     } else {
-        fprintf(fptr, "[%lu", v->vertex->dist);
-        __desenha_arvore_recursivo(v->esquerdo, fptr);
-        __desenha_arvore_recursivo(v->direito, fptr);
+        fprintf(fptr, "[%lu", KDT_node_vertex(v)->dist);
+        __desenha_arvore_recursivo(KDT_node_left(v), fptr);
+        __desenha_arvore_recursivo(KDT_node_right(v), fptr);
         fprintf(fptr, "]");
     }
 }
 
-void desenha_arvore(kd_node_t *root, const char *filename)
+void desenha_arvore(kd_node_t root, const char *filename)
 {
     FILE *fptr = fopen(filename, "w");
     if (fptr == NULL) {
@@ -0,0 +1,196 @@
+/*  Copyright (C) 2023 Rafael Vanali                                        *
+                                                                            *
+    This file is part of hxt_SeqDel, a sequential Delaunay triangulator.    *
+                                                                            *
+    hxt_SeqDel is free software: you can redistribute it and/or modify      *
+    it under the terms of the GNU General Public License as published by    *
+    the Free Software Foundation, either version 3 of the License, or       *
+    (at your option) any later version.                                     *
+                                                                            *
+    hxt_SeqDel is distributed in the hope that it will be useful,           *
+    but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+    GNU General Public License for more details.                            *
+                                                                            *
+    You should have received a copy of the GNU General Public License       *
+    along with hxt_SeqDel.  If not, see <http://www.gnu.org/licenses/>.     *
+                                                                            *
+    See the COPYING file for the GNU General Public License .               *
+                                                                            *
+Author: Rafael Vanali (email@user.com)                                      */
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <omp.h>
+
+#include <cargs.h>
+
+#include <kdt_external.h>
+#include <kdt_io.h>
+#include <kdt_random.h>
+
+static struct cag_option options[] = {
+  {.identifier = 'i',
+    .access_letters = "i",
+    .access_name = "input",
+    .value_name = "FILE",
+    .description = "binary .kdp point file"},
+
+  {.identifier = 'o',
+    .access_letters = "o",
+    .access_name = "output",
+    .value_name = "FILE",
+    .description = "sorted .kdp point file (default: sorted.kdp)"},
+
+  {.identifier = 'x',
+    .access_letters = "x",
+    .access_name = "index",
+    .value_name = "FILE",
+    .description = "also write the original index of each sorted point"},
+
+  {.identifier = 'M',
+    .access_letters = "M",
+    .access_name = "memory",
+    .value_name = "MB",
+    .description = "memory budget in megabytes (default: 1024)"},
+
+  {.identifier = 'g',
+    .access_letters = "g",
+    .access_name = "generate",
+    .value_name = "NUMBER",
+    .description = "first write NUMBER random points within the unit cube to the input .kdp file"},
+
+  {.identifier = 't',
+    .access_letters = "t",
+    .access_name = "threads",
+    .value_name = "NUMBER",
+    .description = "number of threads used by the kd-tree sorting function"},
+
+  {.identifier = 'h',
+    .access_letters = "h",
+    .access_name = "help",
+    .description = "shows the command help"}
+};
+
+// Escreve npts pontos aleatórios no cubo unitário num arquivo .kdp, em blocos; o
+// cabeçalho é reescrito no fim com a bbox dos pontos
+status_t generate_points(const char* filename, uint64_t npts)
+{
+  FILE* file = fopen(filename, "wb");
+  if (file == NULL)
+    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", filename);
+
+  HXT_INFO("writing %lu random points to %s", (unsigned long) npts, filename);
+
+  kd_random_t rng;
+  KDT_random_seed(&rng, 1234567890ULL);
+
+  bbox_t bbox = {{1.0, 1.0, 1.0}, {0.0, 0.0, 0.0}};
+  status_t status = KDT_io_write_header(file, 3*sizeof(double), npts, &bbox);
+
+  double block[3*4096];
+  for (uint64_t i = 0; i < npts && status == HXT_STATUS_OK; i += 4096) {
+    uint64_t m = npts - i < 4096 ? npts - i : 4096;
+    for (uint64_t j = 0; j < 3*m; j++) {
+      block[j] = KDT_random_uniform(&rng);
+      if (block[j] < bbox.min[j%3])
+        bbox.min[j%3] = block[j];
+      if (block[j] > bbox.max[j%3])
+        bbox.max[j%3] = block[j];
+    }
+    if (fwrite(block, 3*sizeof(double), m, file) != m)
+      status = HXT_STATUS_FAILED;
+  }
+
+  if (status == HXT_STATUS_OK && fseek(file, 0, SEEK_SET) != 0)
+    status = HXT_STATUS_FAILED;
+  if (status == HXT_STATUS_OK)
+    status = KDT_io_write_header(file, 3*sizeof(double), npts, &bbox);
+
+  if (fclose(file) != 0 || status != HXT_STATUS_OK)
+    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error writing %s", filename);
+  return HXT_STATUS_OK;
+}
+
+void usage(char *argv[])
+{
+  printf("Usage: %s [OPTION]...\n\n", argv[0]);
+  cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+}
+
+int main(int argc, char **argv)
+{
+  const char *value = NULL;
+  const char *input = NULL;
+  const char *output = "sorted.kdp";
+  const char *index = NULL;
+  uint64_t generate = 0;
+
+  kd_external_options_t ext_options;
+  KDT_external_options_init(&ext_options);
+
+  cag_option_context context;
+  cag_option_init(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
+  while (cag_option_fetch(&context)) {
+    switch (cag_option_get_identifier(&context)) {
+        case 'i':
+          input = cag_option_get_value(&context);
+          break;
+        case 'o':
+          output = cag_option_get_value(&context);
+          break;
+        case 'x':
+          index = cag_option_get_value(&context);
+          break;
+        case 'M':
+          value = cag_option_get_value(&context);
+          ext_options.memory_budget = (size_t) strtoull(value, NULL, 10) << 20;
+          break;
+        case 'g':
+          value = cag_option_get_value(&context);
+          generate = strtoull(value, NULL, 10);
+          break;
+        case 't':
+          value = cag_option_get_value(&context);
+          ext_options.kd_options.num_threads = atoi(value);
+          break;
+        case 'h':
+          usage(argv);
+          return EXIT_SUCCESS;
+        case '?':
+          cag_option_print_error(&context, stdout);
+          return EXIT_FAILURE;
+    }
+  }
+
+  if (input == NULL) {
+    fprintf(stderr, "%s: no input file.\n", argv[0]);
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+
+  if (generate > 0)
+    HXT_CHECK( generate_points(input, generate) );
+
+  double time0 = omp_get_wtime();
+  HXT_CHECK( KDT_external_sort(input, output, index, &ext_options) );
+  double time1 = omp_get_wtime();
+
+  // Vazão medida pelo tamanho do arquivo ordenado
+  FILE* file = fopen(output, "rb");
+  if (file == NULL)
+    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "Cannot open file %s", output);
+  fseek(file, 0, SEEK_END);
+  double megabytes = (double) ftell(file) / (1 << 20);
+  fclose(file);
+
+  struct rusage usage_info;
+  getrusage(RUSAGE_SELF, &usage_info);
+
+  HXT_INFO("external kd sort: %f s, %.1f MB/s", time1 - time0, megabytes / (time1 - time0));
+  HXT_INFO("memory budget: %lu MB, peak resident memory: %.1f MB",
+           (unsigned long) (ext_options.memory_budget >> 20), usage_info.ru_maxrss / 1024.0);
+
+  return HXT_STATUS_OK;
+}
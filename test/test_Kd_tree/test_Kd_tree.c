@@ -20,7 +20,12 @@
 Author: Célestin Marot (celestin.marot@uclouvain.be)                        */
 
 #include <hxt_vertices.h>
+#include <kdt_vertices.h>
+#include <kdt_io.h>
+#include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <omp.h>
 
 // simple visualisation with gmsh
 status_t gmshTetDraw(mesh_t* mesh, const char* filename)
@@ -79,31 +84,16 @@ status_t gmshTetDraw(mesh_t* mesh, const char* filename)
 
 status_t read_nodes(const char* filename, bbox_t* bbox, vertex_t** vertices_p, uint32_t* npts)
 {
-  FILE* file = fopen(filename,"r");
-  if(file==NULL)
-    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot open file");
-
-  if(fscanf(file," %d %*d %*d ", npts)==0)
-    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading 1st line of %s", filename);
-
-  printf("file contain %d vertices\n", *npts);
+  struct stat st;
+  if(stat(filename, &st)!=0)
+    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "cannot open file %s", filename);
 
-  HXT_CHECK( HXT_malloc(vertices_p, sizeof(vertex_t)*(*npts)) );
+  double time0 = omp_get_wtime();
+  HXT_CHECK( KDT_io_read_node(filename, vertices_p, npts, bbox, 0) );
+  double time1 = omp_get_wtime();
 
-  for (uint32_t i=0; i<(*npts); i++){
-    if(fscanf(file, " %*d %lf %lf %lf ", &(*vertices_p)[i].coord[0], &(*vertices_p)[i].coord[1], &(*vertices_p)[i].coord[2])==0)
-      return HXT_ERROR_MSG(HXT_STATUS_FAILED, "error reading %s", filename);
-
-    for (int j=0; j<3; j++) {
-      if((*vertices_p)[i].coord[j]<bbox->min[j])
-        bbox->min[j]=(*vertices_p)[i].coord[j];
-      if((*vertices_p)[i].coord[j]>bbox->max[j])
-        bbox->max[j]=(*vertices_p)[i].coord[j];
-    }
-  }
-
-  fclose(file);
-  puts("finished reading");
+  printf("file contain %u vertices\n", *npts);
+  printf("finished reading: %f s, %.1f MB/s\n", time1 - time0, st.st_size / (1048576.0*(time1 - time0)));
   return HXT_STATUS_OK;
 }
 
@@ -149,6 +139,13 @@ status_t create_nodes(bbox_t* bbox, vertex_t** vertices_p, uint32_t npts)
 }
 
 
+// os arquivos .kdp são pontos no formato binário de kdt_io.h
+int is_kdp(const char* filename)
+{
+  size_t len = strlen(filename);
+  return len>4 && strcmp(filename + len - 4, ".kdp")==0;
+}
+
 
 int main(int argc, char **argv)
 {
@@ -163,8 +160,10 @@ int main(int argc, char **argv)
                 "   3 x2 y2 z2\n"
                 "     ...\n"
                 "   N+1 xN yN zN\n\n"
+                "  or a binary .kdp point file, mapped without copying\n"
                 "  or \"-NUM\" to generate NUM random point inside the unit cube\n\n"
                 "OUTPUT is the tetrahedral mesh in GMSH format\n"
+                "  or a .kdp file to only convert INPUT to the binary point format\n"
                 "  or \"-\" if you do not want any output file", argv[0]);
     return 0;
   }
@@ -172,7 +171,23 @@ int main(int argc, char **argv)
   mesh_t* mesh;
   HXT_CHECK( HXT_mesh_create(&mesh) );
 
-  if(argv[1][0]!='-' || argv[1][1]<'0' || argv[1][1]>'9'){
+  kd_point_file_t points = {0};
+  if(is_kdp(argv[1])){
+    clock_t time_read = clock();
+    HXT_CHECK( KDT_io_map(argv[1], &points) );
+    if(points.vertices==NULL || points.count>UINT32_MAX){
+      HXT_CHECK( KDT_io_unmap(&points) );
+      return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%s cannot be used as a vertex array", argv[1]);
+    }
+
+    // o mesh usa os pontos mapeados; eles são devolvidos antes de HXT_mesh_delete
+    mesh->vertices = points.vertices;
+    mesh->num_vertices = points.count;
+    mesh->size_vertices = points.count;
+    mesh->bbox = points.bbox;
+    printf("mapped %u vertices: %f s\n", mesh->num_vertices, (double) (clock()-time_read) / CLOCKS_PER_SEC);
+  }
+  else if(argv[1][0]!='-' || argv[1][1]<'0' || argv[1][1]>'9'){
     HXT_CHECK( read_nodes(argv[1], &mesh->bbox, &mesh->vertices, &mesh->num_vertices) );
     mesh->size_vertices = mesh->num_vertices;
   }
@@ -184,10 +199,21 @@ int main(int argc, char **argv)
     HXT_CHECK( create_nodes(&mesh->bbox, &mesh->vertices, mesh->num_vertices) );
   }
 
+  if(argc>2 && is_kdp(argv[2])){
+    HXT_CHECK( KDT_io_write(argv[2], mesh->vertices[0].coord, sizeof(vertex_t), mesh->num_vertices, sizeof(vertex_t)) );
+    printf("wrote %u vertices to %s\n", mesh->num_vertices, argv[2]);
+    if(points.map!=NULL){
+      mesh->vertices = NULL;
+      HXT_CHECK( KDT_io_unmap(&points) );
+    }
+    HXT_CHECK( HXT_mesh_delete(&mesh) );
+    return HXT_STATUS_OK;
+  }
+
   clock_t time0 = clock();
 
   // TODO: substituir por nossa ordenação
-  HXT_CHECK( KDT_vertices_BRIO(&mesh->bbox, mesh->vertices, mesh->num_vertices) );
+  HXT_CHECK( KDT_vertices_BRIO(mesh->bbox, mesh->vertices, mesh->num_vertices, NULL) );
   // END TODO
 
   clock_t time1 = clock();
@@ -207,9 +233,13 @@ int main(int argc, char **argv)
   }
   printf("%u vertices, %lu Delaunay tetrahedra, %lu ghosts, %f s\n", mesh->num_vertices, mesh->tetrahedra.num - numGhosts, numGhosts, (double) (time2-time0)/CLOCKS_PER_SEC);
 
-  if(argv[2][0]!='-' || argv[2][1])
+  if(argc>2 && (argv[2][0]!='-' || argv[2][1]))
     HXT_CHECK( gmshTetDraw(mesh, argv[2]) );
 
+  if(points.map!=NULL){
+    mesh->vertices = NULL;
+    HXT_CHECK( KDT_io_unmap(&points) );
+  }
   HXT_CHECK( HXT_mesh_delete(&mesh) );
 
   return HXT_STATUS_OK;
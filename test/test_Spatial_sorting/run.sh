@@ -23,7 +23,7 @@
 runs="1 2 3"
 sizes="1 10 20 30 35 40"
 methods="hxt kdt"
-datasets="axes cube cylinder disk planes paraboloid spiral saddle"
+datasets="axes cube cylinder disk planes paraboloid spiral saddle grid"
 tag=`date +%d-%h-%Y-%H:%M`
 to="vicente.sobrinho@ufca.edu.br"
 
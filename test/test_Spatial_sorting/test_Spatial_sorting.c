@@ -21,13 +21,17 @@ Author: Célestin Marot (celestin.marot@uclouvain.be)                        */
 
 #include <time.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #include <math.h>
 
+#include <omp.h>
+
 #include <cargs.h>
 
 #include <hxt_vertices.h>
 #include <kdt_vertices.h>
+#include <kdt_io.h>
 #include <kdt_point_generators.h>
 
 typedef enum point_distribution {
@@ -39,7 +43,8 @@ typedef enum point_distribution {
   PLANES,
   PARABOLOID,
   SPIRAL,
-  SADDLE
+  SADDLE,
+  GRID
 } Point_distribution;
 
 typedef enum sorting_algorithm {
@@ -67,6 +72,114 @@ static struct cag_option options[] = {
     .value_name = NULL,
     .description = "use the cut-longest-edge kd-tree sorting function"},
 
+  {.identifier = 'I',
+    .access_letters = "I",
+    .access_name = "index",
+    .value_name = NULL,
+    .description = "kd-tree sorting computes an index permutation, then applies it"},
+
+  {.identifier = 'A',
+    .access_letters = "A",
+    .access_name = "attributes",
+    .value_name = NULL,
+    .description = "kd-tree sorting also reorders a per-point field and returns the original point ids"},
+
+  {.identifier = 't',
+    .access_letters = "t",
+    .access_name = "threads",
+    .value_name = "NUMBER",
+    .description = "number of threads used by the kd-tree sorting function"},
+
+  {.identifier = 'm',
+    .access_letters = "m",
+    .access_name = "multiway",
+    .value_name = "LEVELS",
+    .description = "kd-tree levels split per distribution pass on large inputs (0 disables)"},
+
+  {.identifier = 'b',
+    .access_letters = "b",
+    .access_name = "brio",
+    .value_name = "RATIO",
+    .description = "kd-sort the points in random rounds, each RATIO times larger than the previous one"},
+
+  {.identifier = 'f',
+    .access_letters = "f",
+    .access_name = "first-round",
+    .value_name = "NUMBER",
+    .description = "minimum number of points in the first BRIO round"},
+
+  {.identifier = 'e',
+    .access_letters = "e",
+    .access_name = "seed",
+    .value_name = "NUMBER",
+    .description = "seed of the kd-tree sorting random draws"},
+
+  {.identifier = 'D',
+    .access_letters = "D",
+    .access_name = "bfs-levels",
+    .value_name = "LEVELS",
+    .description = "kd-tree levels output breadth-first, deeper subtrees are output whole"},
+
+  {.identifier = 'B',
+    .access_letters = "B",
+    .access_name = "bucket",
+    .value_name = "NUMBER",
+    .description = "kd subtrees with at most NUMBER points are output whole"},
+
+  {.identifier = 'O',
+    .access_letters = "O",
+    .access_name = "inorder",
+    .value_name = NULL,
+    .description = "output whole subtrees in order instead of depth-first"},
+
+  {.identifier = 'n',
+    .access_letters = "n",
+    .access_name = "in-place",
+    .value_name = NULL,
+    .description = "permute the points in place instead of through a second point buffer"},
+
+  {.identifier = 'k',
+    .access_letters = "k",
+    .access_name = "preview",
+    .value_name = "LEVELS",
+    .description = "stream only the first LEVELS kd-tree levels and triangulate that preview"},
+
+  {.identifier = 'l',
+    .access_letters = "l",
+    .access_name = "level-sync",
+    .value_name = NULL,
+    .description = "build the kd-tree one level at a time, emitting each level's medians as it is split"},
+
+  {.identifier = 'v',
+    .access_letters = "v",
+    .access_name = "curve",
+    .value_name = "NAME",
+    .description = "order the nodes of each kd-tree level along a curve: hilbert or morton"},
+
+  {.identifier = 'x',
+    .access_letters = "x",
+    .access_name = "split",
+    .value_name = "POLICY",
+    .description = "kd-tree split axis policy: longest (default), tight, variance, sliding or pca"},
+
+  {.identifier = 'z',
+    .access_letters = "z",
+    .access_name = "pca-size",
+    .value_name = "NUMBER",
+    .description = "with --split pca, smaller kd-tree nodes split along the tight bbox"},
+
+  {.identifier = 'w',
+    .access_letters = "w",
+    .access_name = "write",
+    .value_name = "FILE",
+    .description = "only write the generated point set to FILE in the binary .kdp format"},
+
+  {.identifier = 'r',
+    .access_letters = "r",
+    .access_name = "report",
+    .value_name = NULL,
+    .description = "print the mean distance between consecutive points and the peak resident memory (always on in Debug builds)"},
+
   {.identifier = 'a',
     .access_letters = "a",
     .access_name = "axes",
@@ -121,6 +234,12 @@ static struct cag_option options[] = {
     .value_name = "NUMBER",
     .description = "generate points around saddle surface"},
 
+  {.identifier = 'g',
+    .access_letters = "g",
+    .access_name = "grid",
+    .value_name = "NUMBER",
+    .description = "generate points within a unit cube snapped to a 1/100 grid (many repeated coordinates)"},
+
   {.identifier = 'h',
     .access_letters = "h",
     .access_name = "help",
@@ -180,44 +299,6 @@ status_t gmshTetDraw(mesh_t* mesh, const char* filename)
   return HXT_STATUS_OK;
 }
 
-void __get_bounding_box(mesh_t *mesh)
-{
-    bbox_t bbox;
-    vertex_t *vertices = mesh->vertices;
-
-    bbox.min[0] = vertices[0].coord[0];
-    bbox.min[1] = vertices[0].coord[1];
-    bbox.min[2] = vertices[0].coord[2];
-    bbox.max[0] = vertices[0].coord[0];
-    bbox.max[1] = vertices[0].coord[1];
-    bbox.max[2] = vertices[0].coord[2];
-
-    for (uint32_t i = 1; i < mesh->num_vertices; i++) {
-        // Update bbbx to X
-        if (vertices[i].coord[0] < bbox.min[0])
-            bbox.min[0] = vertices[i].coord[0];
-
-        if (vertices[i].coord[0] > bbox.max[0])
-            bbox.max[0] = vertices[i].coord[0];
-
-        // Update bbbx to Y
-        if (vertices[i].coord[1] < bbox.min[1])
-            bbox.min[1] = vertices[i].coord[1];
-
-        if (vertices[i].coord[1] > bbox.max[1])
-            bbox.max[1] = vertices[i].coord[1];
-
-        // Update bbbx to Z
-        if (vertices[i].coord[2] < bbox.min[2])
-            bbox.min[2] = vertices[i].coord[2];
-
-        if (vertices[i].coord[2] > bbox.max[2])
-            bbox.max[2] = vertices[i].coord[2];
-    }
-
-    mesh->bbox = bbox;
-}
-
 status_t create_vertices(uint32_t npts, Point_distribution d, mesh_t* mesh)
 {
   #ifndef NDEBUG
@@ -253,17 +334,119 @@ status_t create_vertices(uint32_t npts, Point_distribution d, mesh_t* mesh)
       case SADDLE:
           points_around_saddle(mesh->vertices, npts);
           break;
+      case GRID:
+          points_on_grid(mesh->vertices, npts, 100);
+          break;
       default:
           return HXT_STATUS_FAILED;
   }
   mesh->num_vertices  = npts;
   mesh->size_vertices = npts;
 
-  __get_bounding_box(mesh);
+  HXT_CHECK( KDT_vertices_bbox(mesh->vertices, npts, &mesh->bbox, NULL) );
 
   return HXT_STATUS_OK;
 }
 
+status_t kdt_sort_by_index(mesh_t* mesh, const kd_options_t* options)
+{
+  uint32_t* order = NULL;
+  HXT_CHECK( HXT_malloc(&order, sizeof(uint32_t)*mesh->num_vertices) );
+
+  HXT_CHECK( KDT_vertices_order(mesh->bbox, mesh->vertices[0].coord, sizeof(vertex_t), mesh->num_vertices, order, options) );
+  HXT_CHECK( KDT_vertices_permute(mesh->vertices, mesh->num_vertices, order) );
+
+  HXT_CHECK( HXT_free(&order) );
+  return HXT_STATUS_OK;
+}
+
+// Prévia: produz só os primeiros níveis da ordem KD, um por vez, e deixa na malha
+// apenas os pontos desses níveis. Os pontos da malha são a área de trabalho da
+// ordenação, então os níveis vão para um buffer que cresce com eles e só são
+// copiados para a malha no fim
+status_t kdt_preview(mesh_t* mesh, int levels, const kd_options_t* options)
+{
+  kd_stream_t* stream = NULL;
+  HXT_CHECK( KDT_stream_create(&stream, mesh->bbox, mesh->vertices, mesh->num_vertices, NULL, options) );
+
+  vertex_t* preview = NULL;
+  uint32_t capacity = 0;
+
+  double time0 = omp_get_wtime();
+  for (int l = 0; l < levels; l++) {
+    const vertex_t* level;
+    uint32_t count;
+    HXT_CHECK( KDT_stream_next_level(stream, &level, &count) );
+    if (count == 0)
+      break;
+
+    const uint32_t done = KDT_stream_done(stream);
+    if (done > capacity) {
+      uint64_t size = 2*(uint64_t) capacity;
+      size = (size < done) ? done : (size > mesh->num_vertices) ? mesh->num_vertices : size;
+      vertex_t* grown = NULL;
+      HXT_CHECK( HXT_malloc(&grown, sizeof(vertex_t)*size) );
+      if (preview != NULL)
+        memcpy(grown, preview, sizeof(vertex_t)*(done - count));
+      HXT_CHECK( HXT_free(&preview) );
+      preview = grown;
+      capacity = size;
+    }
+    memcpy(preview + done - count, level, sizeof(vertex_t)*count);
+    HXT_INFO("level %d: %u points, %u in total, %f s", l, count, KDT_stream_done(stream), omp_get_wtime() - time0);
+  }
+
+  mesh->num_vertices = KDT_stream_done(stream);
+  if (preview != NULL)
+    memcpy(mesh->vertices, preview, sizeof(vertex_t)*mesh->num_vertices);
+
+  HXT_CHECK( HXT_free(&preview) );
+  HXT_CHECK( KDT_stream_destroy(&stream) );
+  return HXT_STATUS_OK;
+}
+
+// Ordena os pontos levando junto um campo por ponto (aqui, a norma do ponto) e
+// confere o campo, os ids originais e a permutação inversa depois da ordenação
+status_t kdt_sort_with_attributes(mesh_t* mesh, const kd_options_t* options)
+{
+  const uint32_t n = mesh->num_vertices;
+  vertex_t* original = NULL;
+  double* field = NULL;
+  uint32_t* ids = NULL;
+  uint32_t* inverse = NULL;
+  HXT_CHECK( HXT_malloc(&original, sizeof(vertex_t)*n) );
+  HXT_CHECK( HXT_malloc(&field, sizeof(double)*n) );
+  HXT_CHECK( HXT_malloc(&ids, sizeof(uint32_t)*n) );
+  HXT_CHECK( HXT_malloc(&inverse, sizeof(uint32_t)*n) );
+  memcpy(original, mesh->vertices, sizeof(vertex_t)*n);
+
+  for (uint32_t i = 0; i < n; i++) {
+    const double* p = mesh->vertices[i].coord;
+    field[i] = sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+  }
+
+  kd_attribute_t attribute = { field, sizeof(double), sizeof(double) };
+  HXT_CHECK( KDT_vertices_BRIO_attributes(mesh->bbox, mesh->vertices, n, &attribute, 1, ids, inverse, options) );
+
+  // cada ponto ordenado deve ser o ponto original ids[i], com o seu atributo
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    const double* p = original[ids[i]].coord;
+    if (memcmp(mesh->vertices[i].coord, p, 3*sizeof(double)) != 0
+     || field[i] != sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]) || inverse[ids[i]] != i)
+      errors++;
+  }
+  if (errors > 0)
+    return HXT_ERROR_MSG(HXT_STATUS_FAILED, "%u points lost their attributes", errors);
+  HXT_INFO("attributes and original ids follow the %u sorted points", n);
+
+  HXT_CHECK( HXT_free(&inverse) );
+  HXT_CHECK( HXT_free(&ids) );
+  HXT_CHECK( HXT_free(&field) );
+  HXT_CHECK( HXT_free(&original) );
+  return HXT_STATUS_OK;
+}
+
 void usage(char *argv[])
 {
   printf("Usage: %s [OPTION]...\n\n", argv[0]);
@@ -276,8 +459,20 @@ int main(int argc, char **argv)
   uint32_t npts = 0;
   const char *value = NULL;
   Sorting_algorithm alg = -1;
+  kd_options_t kd_options;
+  int kd_index = 0;
+  int kd_attributes = 0;
+  int kd_preview = 0;
+  const char *kdp_file = NULL;
+  #ifndef NDEBUG
+  int report = 1;
+  #else
+  int report = 0;
+  #endif
   cag_option_context context;
 
+  KDT_options_init(&kd_options);
+
   HXT_CHECK( HXT_mesh_create(&mesh) );
 
   // Grab help menu
@@ -355,12 +550,105 @@ int main(int argc, char **argv)
           npts = atoi(value);
           HXT_CHECK( create_vertices(npts, SADDLE, mesh) );
           break;
+        case 'g':
+          #ifndef NDEBUG
+          HXT_INFO("generating points on a grid");
+          #endif
+          value = cag_option_get_value(&context);
+          npts = atoi(value);
+          HXT_CHECK( create_vertices(npts, GRID, mesh) );
+          break;
         case 'H':
           alg = HXT;
           break;
         case 'K':
           alg = KDT;
           break;
+        case 'I':
+          kd_index = 1;
+          break;
+        case 'A':
+          kd_attributes = 1;
+          break;
+        case 't':
+          value = cag_option_get_value(&context);
+          kd_options.num_threads = atoi(value);
+          break;
+        case 'm':
+          value = cag_option_get_value(&context);
+          kd_options.multiway_levels = atoi(value);
+          break;
+        case 'b':
+          value = cag_option_get_value(&context);
+          kd_options.brio_ratio = atof(value);
+          break;
+        case 'f':
+          value = cag_option_get_value(&context);
+          kd_options.brio_first_round = atoi(value);
+          break;
+        case 'e':
+          value = cag_option_get_value(&context);
+          kd_options.seed = strtoull(value, NULL, 10);
+          break;
+        case 'D':
+          value = cag_option_get_value(&context);
+          kd_options.bfs_levels = atoi(value);
+          break;
+        case 'B':
+          value = cag_option_get_value(&context);
+          kd_options.bucket_size = atoi(value);
+          break;
+        case 'O':
+          kd_options.subtree_order = KDT_INORDER;
+          break;
+        case 'n':
+          kd_options.in_place = 1;
+          break;
+        case 'l':
+          kd_options.level_sync = 1;
+          break;
+        case 'k':
+          value = cag_option_get_value(&context);
+          kd_preview = atoi(value);
+          break;
+        case 'v':
+          value = cag_option_get_value(&context);
+          if (strcmp(value, "hilbert") == 0) {
+            kd_options.level_curve = KDT_CURVE_HILBERT;
+          } else if (strcmp(value, "morton") == 0) {
+            kd_options.level_curve = KDT_CURVE_MORTON;
+          } else {
+            fprintf(stderr, "%s: unknown curve '%s'.\n", argv[0], value);
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'x':
+          value = cag_option_get_value(&context);
+          if (strcmp(value, "longest") == 0) {
+            kd_options.split_policy = KDT_SPLIT_LONGEST_EDGE;
+          } else if (strcmp(value, "tight") == 0) {
+            kd_options.split_policy = KDT_SPLIT_TIGHT_BBOX;
+          } else if (strcmp(value, "variance") == 0) {
+            kd_options.split_policy = KDT_SPLIT_MAX_VARIANCE;
+          } else if (strcmp(value, "sliding") == 0) {
+            kd_options.split_policy = KDT_SPLIT_SLIDING_MIDPOINT;
+          } else if (strcmp(value, "pca") == 0) {
+            kd_options.split_policy = KDT_SPLIT_PCA;
+          } else {
+            fprintf(stderr, "%s: unknown split policy '%s'.\n", argv[0], value);
+            return EXIT_FAILURE;
+          }
+          break;
+        case 'z':
+          value = cag_option_get_value(&context);
+          kd_options.pca_size = atoi(value);
+          break;
+        case 'w':
+          kdp_file = cag_option_get_value(&context);
+          break;
+        case 'r':
+          report = 1;
+          break;
         case 'h':
           usage(argv);
           return EXIT_SUCCESS;
@@ -377,6 +665,14 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
   }
 
+  // Convert the point set to the binary format
+  if (kdp_file != NULL) {
+    HXT_CHECK( KDT_io_write(kdp_file, mesh->vertices[0].coord, sizeof(vertex_t), mesh->num_vertices, sizeof(vertex_t)) );
+    HXT_INFO("%u vertices written to %s", mesh->num_vertices, kdp_file);
+    HXT_CHECK( HXT_mesh_delete(&mesh) );
+    return HXT_STATUS_OK;
+  }
+
   // Check sorting algorithm
   if (alg == UNDEFINED_ALGORITHM) {
     fprintf(stderr, "%s: undefined sorting algorithm.\n", argv[0]);
@@ -385,6 +681,7 @@ int main(int argc, char **argv)
   }
 
   // Run the spatial sorting algorithm
+  double jump0 = report ? KDT_vertices_mean_distance(mesh->vertices, mesh->num_vertices) : 0.0;
   #ifndef NDEBUG
   HXT_INFO("sorting algorithm: %s", ((alg == HXT)?("HXT native"):("cut-longest-edge kd-tree")));
   clock_t time0 = clock();
@@ -394,7 +691,15 @@ int main(int argc, char **argv)
           HXT_CHECK( HXT_vertices_BRIO(&mesh->bbox, mesh->vertices, mesh->num_vertices) );
           break;
       case KDT:
-          HXT_CHECK( KDT_vertices_BRIO(mesh->bbox, mesh->vertices, mesh->num_vertices) );
+          if (kd_preview > 0) {
+            HXT_CHECK( kdt_preview(mesh, kd_preview, &kd_options) );
+          } else if (kd_attributes) {
+            HXT_CHECK( kdt_sort_with_attributes(mesh, &kd_options) );
+          } else if (kd_index) {
+            HXT_CHECK( kdt_sort_by_index(mesh, &kd_options) );
+          } else {
+            HXT_CHECK( KDT_vertices_BRIO(mesh->bbox, mesh->vertices, mesh->num_vertices, &kd_options) );
+          }
           break;
       default:
           break;
@@ -403,6 +708,15 @@ int main(int argc, char **argv)
   #ifndef NDEBUG
   printf("BRIO: %f s\n", (double) (time1-time0) / CLOCKS_PER_SEC);
   #endif // DEBUG
+  if (report) {
+    HXT_INFO("mean distance between consecutive points: %g before sorting, %g after",
+             jump0, KDT_vertices_mean_distance(mesh->vertices, mesh->num_vertices));
+    struct rusage usage_info;
+    getrusage(RUSAGE_SELF, &usage_info);
+    HXT_INFO("peak resident memory after sorting: %.1f MB (points: %.1f MB)", usage_info.ru_maxrss / 1024.0,
+             (double) mesh->num_vertices * sizeof(vertex_t) / (1 << 20));
+  }
+  time1 = clock();
   // this is were we are really doing the delaunay...
   HXT_CHECK( HXT_tetrahedra_compute(mesh) );
   clock_t time2 = clock();